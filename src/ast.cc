@@ -4,7 +4,7 @@
 #include "ast.h"
 #include "ast_visitor.h"
 
-AST::AST() {
+AST::AST() : line(0) {
     children = new std::vector<AST*>;
     namedChildren = new std::map<std::string, AST*>;
 }
@@ -40,6 +40,18 @@ void AST::add(std::string name, AST *ast) {
     (*namedChildren)[name] = ast;
 }
 
+ASTKind AST::getKind() const {
+    return kind;
+}
+
+int AST::getLine() const {
+    return line;
+}
+
+void AST::setLine(int line) {
+    this->line = line;
+}
+
 void AST::print(std::ostream &out) const {
     out << "( ";
     for (AST* child : *children) {
@@ -53,8 +65,13 @@ std::ostream& operator<<(std::ostream &out, const AST &ast) {
     return out;
 }
 
-ASTLeaf::ASTLeaf() {}
-ASTLeaf::ASTLeaf(Token *token) : token(token) {}
+ASTLeaf::ASTLeaf() {
+    kind = ASTKind::Leaf;
+}
+
+ASTLeaf::ASTLeaf(Token *token) : token(token) {
+    kind = ASTKind::Leaf;
+}
 
 Token* ASTLeaf::getToken() const {
     return token;
@@ -75,6 +92,7 @@ void ASTLeaf::accept(ASTVisitor *visitor) {
 }
 
 VariableAST::VariableAST(std::string name) : AST() {
+    kind = ASTKind::Variable;
     add("name", new ASTLeaf(new IdentifierToken(name)));
 }
 
@@ -90,11 +108,16 @@ std::string VariableAST::getName() {
     return dynamic_cast<ASTLeaf*>(get("name"))->getToken()->getText();
 }
 
+bool VariableAST::hasTypeName() {
+    return get("typeName") != NULL;
+}
+
 std::string VariableAST::getTypeName() {
     return dynamic_cast<ASTLeaf*>(get("typeName"))->getToken()->getText();
 }
 
 BinaryExprAST::BinaryExprAST(std::string tokenName, AST *ast) : AST() {
+    kind = ASTKind::BinaryExpr;
     Token* token = new IdentifierToken(tokenName);
     ASTLeaf* op = new ASTLeaf(token);
     add(op);
@@ -122,9 +145,11 @@ void BinaryExprAST::accept(ASTVisitor *visitor) {
 }
 
 ArgumentsAST::ArgumentsAST() : AST() {
+    kind = ASTKind::Arguments;
 }
 
 ArgumentsAST::ArgumentsAST(AST *arg) : AST(arg) {
+    kind = ASTKind::Arguments;
 }
 
 void ArgumentsAST::accept(ASTVisitor *visitor) {
@@ -140,6 +165,7 @@ VariableAST *ArgumentsAST::get(int i) {
 }
 
 CallFunctionAST::CallFunctionAST(std::string name, AST *args) : AST() {
+    kind = ASTKind::CallFunction;
     Token* token = new IdentifierToken(name);
     ASTLeaf* funName = new ASTLeaf(token);
     add(funName);
@@ -159,9 +185,11 @@ ArgumentsAST* CallFunctionAST::arguments() {
 }
 
 IfAST::IfAST(AST *expr, AST *block) : AST(expr, block) {
+    kind = ASTKind::If;
 }
 
 IfAST::IfAST(AST *expr, AST *thenBlock, AST *elseBlock) : AST(expr, thenBlock) {
+    kind = ASTKind::If;
     add(elseBlock);
 }
 
@@ -190,16 +218,22 @@ void IfAST::accept(ASTVisitor *visitor) {
 }
 
 DefAST::DefAST(std::string name, AST *args, AST *body, std::string typeName) : AST() {
+    kind = ASTKind::Def;
     add(new ASTLeaf(new IdentifierToken(name)));
     add(args);
-    add(body);
+    // A declaration keeps an empty body slot so the type stays at index 3.
+    children->push_back(body);
     add(new ASTLeaf(new IdentifierToken(typeName)));
 }
 
 DefAST::DefAST(std::string name, AST *body, std::string typeName) : DefAST(name, new ArgumentsAST(), body, typeName) {}
 
 void DefAST::print(std::ostream &out) const {
-    out << "( def " << name() << *arguments() << " " << *body() << " )";
+    out << "( def " << name() << *arguments();
+    if (!isDeclaration()) {
+        out << " " << *body();
+    }
+    out << " )";
 }
 
 std::string DefAST::name() const {
@@ -214,6 +248,10 @@ AST* DefAST::body() const {
     return get(2);
 }
 
+bool DefAST::isDeclaration() const {
+    return body() == NULL;
+}
+
 std::string DefAST::getTypeName() {
     return dynamic_cast<ASTLeaf *>(get(3))->getToken()->getText();;
 }
@@ -222,11 +260,117 @@ void DefAST::accept(ASTVisitor *visitor) {
     visitor->visit(this);
 }
 
+ParallelForAST::ParallelForAST(std::string variableName, AST *from, AST *to, std::string reduction, AST *body) : AST() {
+    kind = ASTKind::ParallelFor;
+    add(new ASTLeaf(new IdentifierToken(variableName)));
+    add(from);
+    add(to);
+    add(new ASTLeaf(new IdentifierToken(reduction)));
+    add(body);
+}
+
+void ParallelForAST::print(std::ostream &out) const {
+    out << "( parallel for " << variableName() << " in " << *from() << " .. " << *to() << " reduce " << reduction() << " " << *body() << " )";
+}
+
+std::string ParallelForAST::variableName() const {
+    return dynamic_cast<ASTLeaf*>(get(0))->getToken()->getText();
+}
+
+AST* ParallelForAST::from() const {
+    return get(1);
+}
+
+AST* ParallelForAST::to() const {
+    return get(2);
+}
+
+std::string ParallelForAST::reduction() const {
+    return dynamic_cast<ASTLeaf*>(get(3))->getToken()->getText();
+}
+
+AST* ParallelForAST::body() const {
+    return get(4);
+}
+
+void ParallelForAST::accept(ASTVisitor *visitor) {
+    visitor->visit(this);
+}
+
+ForAST::ForAST(std::string variableName, AST *iterable, AST *body) : AST() {
+    kind = ASTKind::For;
+    add(new ASTLeaf(new IdentifierToken(variableName)));
+    add(body);
+    add(iterable);
+}
+
+ForAST::ForAST(std::string variableName, AST *from, AST *to, AST *body) : ForAST(variableName, from, body) {
+    add(to);
+}
+
+void ForAST::print(std::ostream &out) const {
+    out << "( for " << variableName() << " in " << *from();
+    if (isRange()) {
+        out << " .. " << *to();
+    }
+    out << " " << *body() << " )";
+}
+
+std::string ForAST::variableName() const {
+    return dynamic_cast<ASTLeaf*>(get(0))->getToken()->getText();
+}
+
+AST* ForAST::body() const {
+    return get(1);
+}
+
+bool ForAST::isRange() const {
+    return children->size() > 3;
+}
+
+AST* ForAST::iterable() const {
+    return get(2);
+}
+
+AST* ForAST::from() const {
+    return get(2);
+}
+
+AST* ForAST::to() const {
+    return isRange() ? get(3) : NULL;
+}
+
+void ForAST::accept(ASTVisitor *visitor) {
+    visitor->visit(this);
+}
+
+YieldAST::YieldAST(AST *value) : AST(value) {
+    kind = ASTKind::Yield;
+}
+
+AST* YieldAST::value() const {
+    return get(0);
+}
+
+void YieldAST::print(std::ostream &out) const {
+    out << "( yield " << *value() << " )";
+}
+
+void YieldAST::accept(ASTVisitor *visitor) {
+    visitor->visit(this);
+}
+
+TopAST::TopAST() : AST() {
+    kind = ASTKind::Top;
+}
+
 void TopAST::accept(ASTVisitor *visitor) {
     visitor->visit(this);
 }
 
-BlockAST::BlockAST(AST *ast) : AST(ast) {};
+BlockAST::BlockAST(AST *ast) : AST(ast) {
+    kind = ASTKind::Block;
+}
 
 void BlockAST::accept(ASTVisitor *visitor) {
     visitor->visit(this);
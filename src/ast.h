@@ -5,6 +5,21 @@
 
 class ASTVisitor;
 
+enum class ASTKind {
+    Leaf,
+    Variable,
+    BinaryExpr,
+    Arguments,
+    CallFunction,
+    If,
+    Def,
+    ParallelFor,
+    For,
+    Yield,
+    Top,
+    Block,
+};
+
 class AST {
 public:
     AST();
@@ -17,8 +32,13 @@ public:
     void add(std::string, AST*);
     virtual void print(std::ostream&) const;
     virtual void accept(ASTVisitor*) = 0;
+    ASTKind getKind() const;
+    int getLine() const;
+    void setLine(int);
     friend std::ostream& operator<<(std::ostream&, const AST&);
 protected:
+    ASTKind kind;
+    int line;
     std::vector<AST*>* children;
     std::map<std::string, AST*>* namedChildren;
 };
@@ -40,6 +60,7 @@ public:
     VariableAST(std::string, std::string);
     void accept(ASTVisitor*);
     std::string getName();
+    bool hasTypeName();
     std::string getTypeName();
 };
 
@@ -89,12 +110,48 @@ public:
     std::string name() const;
     ArgumentsAST* arguments() const;
     AST* body() const;
+    bool isDeclaration() const;
     std::string getTypeName();
     void accept(ASTVisitor*);
 };
 
+class ParallelForAST : public AST {
+public:
+    ParallelForAST(std::string, AST*, AST*, std::string, AST*);
+    virtual void print(std::ostream&) const;
+    std::string variableName() const;
+    AST* from() const;
+    AST* to() const;
+    std::string reduction() const;
+    AST* body() const;
+    void accept(ASTVisitor*);
+};
+
+class ForAST : public AST {
+public:
+    ForAST(std::string, AST*, AST*);
+    ForAST(std::string, AST*, AST*, AST*);
+    virtual void print(std::ostream&) const;
+    std::string variableName() const;
+    AST* body() const;
+    bool isRange() const;
+    AST* iterable() const;
+    AST* from() const;
+    AST* to() const;
+    void accept(ASTVisitor*);
+};
+
+class YieldAST : public AST {
+public:
+    YieldAST(AST*);
+    AST* value() const;
+    virtual void print(std::ostream&) const;
+    void accept(ASTVisitor*);
+};
+
 class TopAST : public AST {
 public:
+    TopAST();
     void accept(ASTVisitor*);
 };
 
@@ -0,0 +1,143 @@
+#include <climits>
+#include "ast_analysis.h"
+
+YieldFinder::YieldFinder() : yields(false) {
+}
+
+bool YieldFinder::pre(AST *ast) {
+    if (ast->getKind() == ASTKind::Yield) {
+        yields = true;
+    }
+    return !yields && ast->getKind() != ASTKind::Def;
+}
+
+bool YieldFinder::found() const {
+    return yields;
+}
+
+bool FreeVariables::pre(AST *ast) {
+    switch (ast->getKind()) {
+    case ASTKind::Variable: {
+        auto variable = static_cast<VariableAST*>(ast);
+        if (variable->hasTypeName()) {
+            bound.insert(variable->getName());
+        } else if (!bound.count(variable->getName()) && seen.insert(variable->getName()).second) {
+            freeNames.push_back(variable->getName());
+        }
+        return false;
+    }
+    case ASTKind::ParallelFor:
+        bound.insert(static_cast<ParallelForAST*>(ast)->variableName());
+        return true;
+    case ASTKind::For:
+        bound.insert(static_cast<ForAST*>(ast)->variableName());
+        return true;
+    case ASTKind::Def:
+        return false;
+    default:
+        return true;
+    }
+}
+
+const std::vector<std::string> &FreeVariables::names() const {
+    return freeNames;
+}
+
+void ConstantFolder::post(AST *ast) {
+    switch (ast->getKind()) {
+    case ASTKind::Leaf: {
+        auto token = static_cast<ASTLeaf*>(ast)->getToken();
+        if (token->isInteger() || token->isDouble()) {
+            constants[ast] = token;
+        }
+        break;
+    }
+    case ASTKind::BinaryExpr: {
+        auto expr = static_cast<BinaryExprAST*>(ast);
+        if (expr->getChildren()->size() == 2) {
+            auto operand = valueOf(expr->left());
+            if (operand) {
+                IntegerToken zero(0);
+                constants[ast] = fold("-", &zero, operand);
+            }
+        } else if (expr->op() != "=") {
+            auto lValue = valueOf(expr->left());
+            auto rValue = valueOf(expr->right());
+            if (lValue && rValue) {
+                auto value = fold(expr->op(), lValue, rValue);
+                if (value) {
+                    constants[ast] = value;
+                }
+            }
+        }
+        break;
+    }
+    case ASTKind::Block:
+        if (ast->getChildren()->size() == 1 && valueOf(ast->get(0))) {
+            constants[ast] = valueOf(ast->get(0));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+Token *ConstantFolder::valueOf(AST *ast) const {
+    auto found = constants.find(ast);
+    return found == constants.end() ? NULL : found->second;
+}
+
+Token *ConstantFolder::fold(const std::string &op, Token *lToken, Token *rToken) {
+    if (lToken->isDouble() || rToken->isDouble()) {
+        double lValue = lToken->isDouble() ? lToken->getDouble() : lToken->getInteger();
+        double rValue = rToken->isDouble() ? rToken->getDouble() : rToken->getInteger();
+        if (op == "+") {
+            return makeDouble(lValue + rValue);
+        } else if (op == "-") {
+            return makeDouble(lValue - rValue);
+        } else if (op == "*") {
+            return makeDouble(lValue * rValue);
+        } else if (op == "/") {
+            return makeDouble(lValue / rValue);
+        } else if (op == ">") {
+            return makeInteger(lValue > rValue);
+        } else if (op == "<") {
+            return makeInteger(lValue < rValue);
+        }
+    } else {
+        // Stone integers are 64-bit while tokens hold an int, so anything
+        // that does not fit is left for the generated code to compute.
+        long long lValue = lToken->getInteger();
+        long long rValue = rToken->getInteger();
+        long long value;
+        if (op == "+") {
+            value = lValue + rValue;
+        } else if (op == "-") {
+            value = lValue - rValue;
+        } else if (op == "*") {
+            value = lValue * rValue;
+        } else if (op == "/" && rValue != 0) {
+            value = lValue / rValue;
+        } else if (op == ">") {
+            value = lValue > rValue;
+        } else if (op == "<") {
+            value = lValue < rValue;
+        } else {
+            return NULL;
+        }
+        if (value >= INT_MIN && value <= INT_MAX) {
+            return makeInteger(value);
+        }
+    }
+    return NULL;
+}
+
+Token *ConstantFolder::makeInteger(int value) {
+    integers.push_back(IntegerToken(value));
+    return &integers.back();
+}
+
+Token *ConstantFolder::makeDouble(double value) {
+    doubles.push_back(DoubleToken(value));
+    return &doubles.back();
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "ast_traversal.h"
+
+// Finds whether a def body yields, which makes the def a generator.
+// Nested defs are not part of the body and are skipped.
+class YieldFinder : public Traversal<YieldFinder> {
+public:
+    YieldFinder();
+    bool pre(AST*);
+    bool found() const;
+private:
+    bool yields;
+};
+
+// Collects the variables a subtree reads or assigns without declaring
+// them, in order of first use. Typed variables and loop variables count
+// as declarations.
+class FreeVariables : public Traversal<FreeVariables> {
+public:
+    bool pre(AST*);
+    const std::vector<std::string> &names() const;
+private:
+    std::set<std::string> bound;
+    std::set<std::string> seen;
+    std::vector<std::string> freeNames;
+};
+
+// Folds arithmetic and comparisons over literals bottom-up, recording an
+// IntegerToken or DoubleToken for each node whose value is a constant.
+// Folded tokens are owned by the folder and live as long as it does.
+class ConstantFolder : public Traversal<ConstantFolder> {
+public:
+    void post(AST*);
+    Token *valueOf(AST*) const;
+private:
+    std::map<AST*, Token*> constants;
+    std::deque<IntegerToken> integers;
+    std::deque<DoubleToken> doubles;
+    Token *fold(const std::string&, Token*, Token*);
+    Token *makeInteger(int);
+    Token *makeDouble(double);
+};
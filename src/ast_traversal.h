@@ -0,0 +1,136 @@
+#pragma once
+#include <tuple>
+#include "ast.h"
+
+// Statically dispatched counterpart of ASTVisitor. Derived classes provide
+// `Result visit(XxxAST*)` for the node kinds they care about (with
+// `using StaticVisitor<...>::visit;` to keep the defaults visible) and the
+// rest fall back to visitAST, all without a virtual call.
+template <typename Derived, typename Result = void>
+class StaticVisitor {
+public:
+    Result dispatch(AST *ast) {
+        switch (ast->getKind()) {
+        case ASTKind::Leaf:
+            return derived().visit(static_cast<ASTLeaf*>(ast));
+        case ASTKind::Variable:
+            return derived().visit(static_cast<VariableAST*>(ast));
+        case ASTKind::BinaryExpr:
+            return derived().visit(static_cast<BinaryExprAST*>(ast));
+        case ASTKind::Arguments:
+            return derived().visit(static_cast<ArgumentsAST*>(ast));
+        case ASTKind::CallFunction:
+            return derived().visit(static_cast<CallFunctionAST*>(ast));
+        case ASTKind::If:
+            return derived().visit(static_cast<IfAST*>(ast));
+        case ASTKind::Def:
+            return derived().visit(static_cast<DefAST*>(ast));
+        case ASTKind::ParallelFor:
+            return derived().visit(static_cast<ParallelForAST*>(ast));
+        case ASTKind::For:
+            return derived().visit(static_cast<ForAST*>(ast));
+        case ASTKind::Yield:
+            return derived().visit(static_cast<YieldAST*>(ast));
+        case ASTKind::Top:
+            return derived().visit(static_cast<TopAST*>(ast));
+        case ASTKind::Block:
+            return derived().visit(static_cast<BlockAST*>(ast));
+        }
+        return derived().visitAST(ast);
+    }
+
+    Result visitAST(AST*) { return Result(); }
+    Result visit(ASTLeaf *ast) { return derived().visitAST(ast); }
+    Result visit(VariableAST *ast) { return derived().visitAST(ast); }
+    Result visit(BinaryExprAST *ast) { return derived().visitAST(ast); }
+    Result visit(ArgumentsAST *ast) { return derived().visitAST(ast); }
+    Result visit(CallFunctionAST *ast) { return derived().visitAST(ast); }
+    Result visit(IfAST *ast) { return derived().visitAST(ast); }
+    Result visit(DefAST *ast) { return derived().visitAST(ast); }
+    Result visit(ParallelForAST *ast) { return derived().visitAST(ast); }
+    Result visit(ForAST *ast) { return derived().visitAST(ast); }
+    Result visit(YieldAST *ast) { return derived().visitAST(ast); }
+    Result visit(TopAST *ast) { return derived().visitAST(ast); }
+    Result visit(BlockAST *ast) { return derived().visitAST(ast); }
+
+protected:
+    Derived &derived() { return *static_cast<Derived*>(this); }
+};
+
+// Depth-first walk calling `bool pre(AST*)` before and `void post(AST*)`
+// after the children of each node. Returning false from pre skips the
+// children and the matching post.
+template <typename Derived>
+class Traversal {
+public:
+    void traverse(AST *ast) {
+        if (!ast || !derived().pre(ast)) {
+            return;
+        }
+        for (AST *child : *ast->getChildren()) {
+            traverse(child);
+        }
+        derived().post(ast);
+    }
+
+    bool pre(AST*) { return true; }
+    void post(AST*) {}
+
+protected:
+    Derived &derived() { return *static_cast<Derived*>(this); }
+};
+
+template <size_t I, typename... Passes>
+struct FusedHooks {
+    static void pre(std::tuple<Passes&...> &passes, AST **skipped, AST *ast) {
+        FusedHooks<I - 1, Passes...>::pre(passes, skipped, ast);
+        if (!skipped[I - 1] && !std::get<I - 1>(passes).pre(ast)) {
+            skipped[I - 1] = ast;
+        }
+    }
+
+    static void post(std::tuple<Passes&...> &passes, AST **skipped, AST *ast) {
+        FusedHooks<I - 1, Passes...>::post(passes, skipped, ast);
+        if (!skipped[I - 1]) {
+            std::get<I - 1>(passes).post(ast);
+        } else if (skipped[I - 1] == ast) {
+            skipped[I - 1] = NULL;
+        }
+    }
+};
+
+template <typename... Passes>
+struct FusedHooks<0, Passes...> {
+    static void pre(std::tuple<Passes&...>&, AST**, AST*) {}
+    static void post(std::tuple<Passes&...>&, AST**, AST*) {}
+};
+
+// Runs several Traversal passes in a single walk of the tree. A pass that
+// skips a subtree stays idle until the walk leaves that subtree again.
+template <typename... Passes>
+class FusedTraversal : public Traversal<FusedTraversal<Passes...>> {
+public:
+    FusedTraversal(Passes&... passes) : passes(passes...) {
+        for (auto &skip : skipped) {
+            skip = NULL;
+        }
+    }
+
+    bool pre(AST *ast) {
+        FusedHooks<sizeof...(Passes), Passes...>::pre(passes, skipped, ast);
+        return true;
+    }
+
+    void post(AST *ast) {
+        FusedHooks<sizeof...(Passes), Passes...>::post(passes, skipped, ast);
+    }
+
+private:
+    std::tuple<Passes&...> passes;
+    AST *skipped[sizeof...(Passes)];
+};
+
+template <typename... Passes>
+FusedTraversal<Passes...> fuse(Passes&... passes) {
+    return FusedTraversal<Passes...>(passes...);
+}
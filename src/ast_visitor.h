@@ -10,6 +10,9 @@ public:
     virtual void visit(CallFunctionAST*) = 0;
     virtual void visit(IfAST*) = 0;
     virtual void visit(DefAST*) = 0;
+    virtual void visit(ParallelForAST*) = 0;
+    virtual void visit(ForAST*) = 0;
+    virtual void visit(YieldAST*) = 0;
     virtual void visit(TopAST*) = 0;
     virtual void visit(BlockAST*) = 0;
     virtual void visit(VariableAST*) = 0;
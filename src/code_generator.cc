@@ -1,57 +1,188 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <cstdio>
+#include <cstdlib>
+#include <mutex>
 #include "code_generator.h"
+#include "jit_listener.h"
+#include "profiler.h"
 
-CodeGenerator::CodeGenerator() {
-    llvm::InitializeNativeTarget();
-    module = new llvm::Module("top", llvm::getGlobalContext());
-    builder = new llvm::IRBuilder<>(llvm::getGlobalContext());
-    namedValues = new std::map<std::string, llvm::AllocaInst*>;
-    executionEngine = llvm::EngineBuilder(module).create();
+CodeGenerator::CodeGenerator() : CodeGenerator("<stdin>") {
+}
+
+CodeGenerator::CodeGenerator(const std::string &fileName) {
+    // Each generator owns its context so separate units can be compiled
+    // on separate threads.
+    static std::once_flag initialized;
+    std::call_once(initialized, [] {
+        llvm::llvm_start_multithreaded();
+        llvm::InitializeNativeTarget();
+    });
+    context = new llvm::LLVMContext();
+    errorCount = 0;
+    profiling = false;
+    profileId = -1;
+    profileToken = NULL;
+    inferring = false;
+    constants = NULL;
+    module = new llvm::Module("top", *context);
+    builder = new llvm::IRBuilder<>(*context);
+    namedValues = new std::map<std::string, llvm::Value*>;
+    generators = new std::map<std::string, Generator*>;
+    undefinedFunctions = new std::set<std::string>;
+    pendingStatements = new std::vector<AST*>;
+    currentGenerator = NULL;
+    llvm::TargetOptions targetOptions;
+    targetOptions.JITEmitDebugInfo = std::getenv("STONE_GDB") != NULL;
+    executionEngine = llvm::EngineBuilder(module).setTargetOptions(targetOptions).create();
+    if (JITListener::getInstance()->isEnabled()) {
+        executionEngine->RegisterJITEventListener(JITListener::getInstance());
+    }
+    debugBuilder = new llvm::DIBuilder(*module);
+    debugBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C, fileName, ".", "stone", false, "", 0);
+    debugFile = debugBuilder->createFile(fileName, ".");
+    debugScope = NULL;
     functionPassManager = new llvm::FunctionPassManager(module);
     functionPassManager->add(new llvm::DataLayout(*executionEngine->getDataLayout()));
     functionPassManager->add(llvm::createBasicAliasAnalysisPass());
+    functionPassManager->add(llvm::createSROAPass());
     functionPassManager->add(llvm::createInstructionCombiningPass());
     functionPassManager->add(llvm::createReassociatePass());
     functionPassManager->add(llvm::createGVNPass());
     functionPassManager->add(llvm::createCFGSimplificationPass());
     functionPassManager->doInitialization();
+    declareRuntime();
 }
 
 CodeGenerator::~CodeGenerator() {
+    debugBuilder->finalize();
+    delete debugBuilder;
+    delete functionPassManager;
+    delete builder;
+    delete executionEngine;
+    delete context;
+    for (auto &generator : *generators) {
+        delete generator.second;
+    }
+    delete generators;
+    delete namedValues;
+    delete undefinedFunctions;
+    delete pendingStatements;
 }
 
 void CodeGenerator::execute(TopAST *topAst) {
     visit(topAst);
 }
 
-void CodeGenerator::visit(ASTLeaf *ast) {
+// Defs are compiled as soon as they arrive. Other statements run in source
+// order, but wait while a declared function is still missing its body so
+// that they never call ahead of a forward reference.
+void CodeGenerator::executeStatement(AST *statement) {
+    if (statement->getKind() == ASTKind::Def) {
+        auto function = dispatch(statement);
+        if (function) {
+            function->dump();
+        }
+    } else {
+        pendingStatements->push_back(statement);
+    }
+    if (undefinedFunctions->empty()) {
+        runPendingStatements();
+    }
+}
+
+void CodeGenerator::finish() {
+    for (auto &name : *undefinedFunctions) {
+        error(("function " + name + " is declared but never defined").c_str());
+    }
+    if (undefinedFunctions->empty()) {
+        runPendingStatements();
+    }
+    pendingStatements->clear();
+}
+
+void CodeGenerator::compile(TopAST *topAst) {
+    for (AST* child : *topAst->getChildren()) {
+        if (child->getKind() == ASTKind::Def) {
+            dispatch(child);
+        } else {
+            error(("line " + std::to_string(child->getLine()) + ": only defs can be compiled, statement is not run").c_str());
+        }
+    }
+    finish();
+}
+
+// Signatures are spelled with one character per type, return type first:
+// 'i' for int, 'd' for double and 'b' for the result of a comparison.
+void *CodeGenerator::getPointerToFunction(const std::string &name, const std::string &signature) {
+    auto function = module->getFunction(name);
+    if (!function || function->isDeclaration() || generators->count(name)) {
+        return NULL;
+    }
+    auto functionType = function->getFunctionType();
+    if (signature.size() != functionType->getNumParams() + 1) {
+        return NULL;
+    }
+    for (unsigned i = 0; i < signature.size(); i++) {
+        auto type = i == 0 ? functionType->getReturnType() : functionType->getParamType(i - 1);
+        if (type != getType(signature[i])) {
+            return NULL;
+        }
+    }
+    return executionEngine->getPointerToFunction(function);
+}
+
+void CodeGenerator::enableProfiling() {
+    profiling = true;
+}
+
+bool CodeGenerator::hasErrors() const {
+    return errorCount > 0;
+}
+
+llvm::Value *CodeGenerator::dispatch(AST *ast) {
+    if (debugScope && ast->getLine() > 0) {
+        builder->SetCurrentDebugLocation(llvm::DebugLoc::get(ast->getLine(), 0, debugScope));
+    }
+    return StaticVisitor<CodeGenerator, llvm::Value*>::dispatch(ast);
+}
+
+llvm::Value *CodeGenerator::visit(ASTLeaf *ast) {
     Token *token = ast->getToken();
     if (token->isInteger()) {
-        lastValue = llvm::ConstantInt::get(llvm::getGlobalContext(), llvm::APInt(64, token->getInteger()));
+        return llvm::ConstantInt::get(*context, llvm::APInt(64, token->getInteger()));
     } else if (token->isDouble()) {
-        lastValue = llvm::ConstantFP::get(llvm::getGlobalContext(), llvm::APFloat(token->getDouble()));
+        return llvm::ConstantFP::get(*context, llvm::APFloat(token->getDouble()));
     }
+    return NULL;
 }
 
-void CodeGenerator::visit(BinaryExprAST *ast) {
+llvm::Value *CodeGenerator::visit(BinaryExprAST *ast) {
     if (ast->op() == "=") {
         auto variable = dynamic_cast<VariableAST*>(ast->left());
-        ast->right()->accept(this);
-        auto rValue = lastValue;
+        if (!variable) {
+            error("can only assign to a variable");
+            return NULL;
+        }
+        auto rValue = dispatch(ast->right());
+        if (!rValue) {
+            return NULL;
+        }
         if (!(*namedValues)[variable->getName()]) {
-            auto alloca = createEntryBlockAlloca(builder->GetInsertBlock()->getParent(), variable);
-            (*namedValues)[variable->getName()] = alloca;
+            auto local = createLocal(builder->GetInsertBlock()->getParent(), variable);
+            (*namedValues)[variable->getName()] = local;
         }
         builder->CreateStore(rValue, (*namedValues)[variable->getName()]);
+        return rValue;
     } else {
-        ast->left()->accept(this);
-        auto lValue = lastValue;
-        ast->right()->accept(this);
-        auto rValue = lastValue;
+        auto lValue = dispatch(ast->left());
+        auto rValue = dispatch(ast->right());
+        if (!lValue || !rValue) {
+            return NULL;
+        }
 
         if (ast->op() == "+" || ast->op() == "-" || ast->op() == "*" || ast->op() == "/" || ast->op() == ">" || ast->op() == "<") {
             if (lValue->getType()->isDoubleTy() || rValue->getType()->isDoubleTy()) {
@@ -62,151 +193,715 @@ void CodeGenerator::visit(BinaryExprAST *ast) {
                     rValue = builder->CreateSIToFP(rValue, getType("double"));
                 }
                 if (ast->op() == "+") {
-                    lastValue = builder->CreateFAdd(lValue, rValue);
+                    return builder->CreateFAdd(lValue, rValue);
                 } else if (ast->op() == "-") {
-                    lastValue = builder->CreateFSub(lValue, rValue);
+                    return builder->CreateFSub(lValue, rValue);
                 } else if (ast->op() == "*") {
-                    lastValue = builder->CreateFMul(lValue, rValue);
+                    return builder->CreateFMul(lValue, rValue);
                 } else if (ast->op() == "/") {
-                    lastValue = builder->CreateFDiv(lValue, rValue);
+                    return builder->CreateFDiv(lValue, rValue);
                 } else if (ast->op() == ">") {
-                    lastValue = builder->CreateFCmpOGT(lValue, rValue);
+                    return builder->CreateFCmpOGT(lValue, rValue);
                 } else if (ast->op() == "<") {
-                    lastValue = builder->CreateFCmpOLT(lValue, rValue);
+                    return builder->CreateFCmpOLT(lValue, rValue);
                 }
             } else {
                 if (ast->op() == "+") {
-                    lastValue = builder->CreateAdd(lValue, rValue);
+                    return builder->CreateAdd(lValue, rValue);
                 } else if (ast->op() == "-") {
-                    lastValue = builder->CreateSub(lValue, rValue);
+                    return builder->CreateSub(lValue, rValue);
                 } else if (ast->op() == "*") {
-                    lastValue = builder->CreateMul(lValue, rValue);
+                    return builder->CreateMul(lValue, rValue);
                 } else if (ast->op() == "/") {
-                    lastValue = builder->CreateSDiv(lValue, rValue);
+                    return builder->CreateSDiv(lValue, rValue);
                 } else if (ast->op() == ">") {
-                    lastValue = builder->CreateICmpSGT(lValue, rValue);
+                    return builder->CreateICmpSGT(lValue, rValue);
                 } else if (ast->op() == "<") {
-                    lastValue = builder->CreateICmpSLT(lValue, rValue);
+                    return builder->CreateICmpSLT(lValue, rValue);
                 }
             }
         }
     }
+    return NULL;
 }
 
-void CodeGenerator::visit(ArgumentsAST *ast) {
+llvm::Value *CodeGenerator::visit(ArgumentsAST *ast) {
     error("shoudn't be called");
+    return NULL;
 }
 
-void CodeGenerator::visit(CallFunctionAST *ast) {
+llvm::Value *CodeGenerator::visit(CallFunctionAST *ast) {
+    if (generators->count(ast->name())) {
+        error("generators can only be iterated with for");
+        return NULL;
+    }
     auto function = module->getFunction(ast->name());
+    if (!function) {
+        error(("unknown function " + ast->name()).c_str());
+        return NULL;
+    }
+    if (ast->arguments()->size() != (int)function->arg_size()) {
+        error(("wrong number of arguments to " + ast->name()).c_str());
+        return NULL;
+    }
     std::vector<llvm::Value*> argValues;
     for (AST* arg : *ast->arguments()->getChildren()) {
-        arg->accept(this);
-        argValues.push_back(lastValue);
+        auto argValue = dispatch(arg);
+        if (!argValue) {
+            return NULL;
+        }
+        argValues.push_back(argValue);
     }
-    lastValue = builder->CreateCall(function, argValues);
+    return builder->CreateCall(function, argValues);
 }
 
-void CodeGenerator::visit(IfAST *ast) {
-    ast->condition()->accept(this);
-    auto condValue = lastValue;
+llvm::Value *CodeGenerator::visit(IfAST *ast) {
+    auto constant = constants ? constants->valueOf(ast->condition()) : NULL;
+    bool hasElse = ast->getChildren()->size() > 2;
+    if (constant && constant->isInteger()) {
+        llvm::Value *value = NULL;
+        if (constant->getInteger()) {
+            value = dispatch(ast->thenBlock());
+        } else if (hasElse) {
+            value = dispatch(ast->elseBlock());
+        }
+        return hasElse ? value : llvm::ConstantInt::get(getType("int"), 0);
+    }
+
+    auto condValue = dispatch(ast->condition());
+    if (!condValue) {
+        return NULL;
+    }
 
     auto currentFunction = builder->GetInsertBlock()->getParent();
-    auto thenBlock = llvm::BasicBlock::Create(llvm::getGlobalContext(), "then", currentFunction);
-    auto elseBlock = llvm::BasicBlock::Create(llvm::getGlobalContext(), "else");
-    auto mergeBlock = llvm::BasicBlock::Create(llvm::getGlobalContext(), "merge");
+    auto thenBlock = llvm::BasicBlock::Create(*context, "then", currentFunction);
+    auto elseBlock = llvm::BasicBlock::Create(*context, "else");
+    auto mergeBlock = llvm::BasicBlock::Create(*context, "merge");
     builder->CreateCondBr(condValue, thenBlock, elseBlock);
 
     builder->SetInsertPoint(thenBlock);
-    ast->thenBlock()->accept(this);
-    auto thenValue = lastValue;
+    auto thenValue = dispatch(ast->thenBlock());
 
     builder->CreateBr(mergeBlock);
     thenBlock = builder->GetInsertBlock();
 
     currentFunction->getBasicBlockList().push_back(elseBlock);
     builder->SetInsertPoint(elseBlock);
-    ast->elseBlock()->accept(this);
-    auto elseValue = lastValue;
+    auto elseValue = hasElse ? dispatch(ast->elseBlock()) : NULL;
 
     builder->CreateBr(mergeBlock);
     elseBlock = builder->GetInsertBlock();
 
     currentFunction->getBasicBlockList().push_back(mergeBlock);
     builder->SetInsertPoint(mergeBlock);
+    // Like a loop, an if without an else is a statement and evaluates to 0.
+    if (!hasElse) {
+        return llvm::ConstantInt::get(getType("int"), 0);
+    }
+    if (!thenValue || !elseValue) {
+        return NULL;
+    }
     auto phiNode = builder->CreatePHI(thenValue->getType(), 2);
     phiNode->addIncoming(thenValue, thenBlock);
     phiNode->addIncoming(elseValue, elseBlock);
 
-    lastValue = phiNode;
+    return phiNode;
 }
 
-void CodeGenerator::visit(DefAST *ast) {
+llvm::Value *CodeGenerator::visit(DefAST *ast) {
+    if (ast->isDeclaration()) {
+        return declareFunction(ast);
+    }
+
+    // A single fused walk of the body finds yields and folds the constants
+    // that visit(IfAST) looks up later.
+    YieldFinder yieldFinder;
+    ConstantFolder constantFolder;
+    fuse(yieldFinder, constantFolder).traverse(ast->body());
+    auto savedConstants = constants;
+    auto savedProfileId = profileId;
+    auto savedProfileToken = profileToken;
+    constants = &constantFolder;
+    auto function = !ast->name().empty() && yieldFinder.found() ? visitGenerator(ast) : visitFunction(ast);
+    constants = savedConstants;
+    profileId = savedProfileId;
+    profileToken = savedProfileToken;
+    return function;
+}
+
+llvm::Value *CodeGenerator::visitFunction(DefAST *ast) {
+    auto last = &module->getFunctionList().back();
+    auto undefined = *undefinedFunctions;
+    int errors = errorCount;
     namedValues->clear();
     auto argTypes = createArgTypes(ast->arguments());
     auto functionReturnType = getType(ast->getTypeName());
     if (!functionReturnType) {
         functionReturnType = getType(ast);
+        if (!functionReturnType) {
+            return NULL;
+        }
     }
     auto *functionType = llvm::FunctionType::get(functionReturnType, *argTypes, false);
-    auto function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, ast->name(), module);
+    auto name = ast->name().empty() ? "top." + std::to_string(ast->getLine()) : ast->name();
+    auto function = module->getFunction(name);
+    if (function && undefinedFunctions->count(name) && function->getFunctionType() == functionType) {
+        undefinedFunctions->erase(name);
+    } else {
+        if (function && undefinedFunctions->count(name)) {
+            error(("definition of " + name + " does not match its declaration").c_str());
+        }
+        function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, name, module);
+    }
 
-    auto *block = llvm::BasicBlock::Create(llvm::getGlobalContext(), "entry", function);
+    auto *block = llvm::BasicBlock::Create(*context, "entry", function);
     builder->SetInsertPoint(block);
+    beginFunction(function, ast->getLine());
 
     setFunctionArguments(function, ast->arguments());
 
-    ast->body()->accept(this);
-    builder->CreateRet(lastValue);
+    auto body = dispatch(ast->body());
+    if (!body || errorCount > errors) {
+        if (errorCount == errors) {
+            error(("body of " + name + " has no value").c_str());
+        }
+        discardFunctionsAfter(last, undefined);
+        return NULL;
+    }
+    createReturn(body);
 
     functionPassManager->run(*function);
 
-    lastValue = function;
+    return function;
 }
 
-void CodeGenerator::visit(TopAST *ast) {
-    for (AST* child : *ast->getChildren()) {
-        if (typeid(*child) == typeid(DefAST)) {
-            child->accept(this);
-            lastValue->dump();
-        } else {
-            (new DefAST("", child, ""))->accept(this);
-            auto function = dynamic_cast<llvm::Function*>(lastValue);
-            function->dump();
-            std::cout << "Evaluated to ";
-            if (function->getReturnType()->isIntegerTy()) {
-                int (*fp)() = (int (*)())(intptr_t)executionEngine->getPointerToFunction(function);
-                std::cout << fp();
-            } else if (function->getReturnType()->isDoubleTy()) {
-                double (*fp)() = (double (*)())(intptr_t)executionEngine->getPointerToFunction(function);
-                std::cout <<  fp();
-            }
-            std::cout <<  std::endl;
+llvm::Value *CodeGenerator::visit(ParallelForAST *ast) {
+    int reduction = getReduction(ast->reduction());
+    if (reduction < 0) {
+        error("unknown reduction in parallel for");
+        return NULL;
+    }
+
+    auto fromValue = dispatch(ast->from());
+    auto toValue = dispatch(ast->to());
+    if (!fromValue || !toValue) {
+        return NULL;
+    }
+    if (!fromValue->getType()->isIntegerTy(64) || !toValue->getType()->isIntegerTy(64)) {
+        error("parallel for range must be int");
+        return NULL;
+    }
+
+    FreeVariables freeVariables;
+    YieldFinder yieldFinder;
+    fuse(freeVariables, yieldFinder).traverse(ast->body());
+    if (yieldFinder.found()) {
+        error("cannot yield from a parallel for");
+        return NULL;
+    }
+
+    // Free variables of the body are captured by value into an environment
+    // struct which the outlined body unpacks into its own locals.
+    std::vector<std::string> names;
+    std::vector<llvm::Type*> types;
+    std::vector<llvm::Value*> values;
+    for (auto &name : freeVariables.names()) {
+        auto namedValue = namedValues->find(name);
+        if (name != ast->variableName() && namedValue != namedValues->end() && namedValue->second) {
+            names.push_back(name);
+            types.push_back(llvm::cast<llvm::PointerType>(namedValue->second->getType())->getElementType());
+            values.push_back(builder->CreateLoad(namedValue->second));
         }
     }
+    auto envType = llvm::StructType::get(*context, types);
+    auto currentFunction = builder->GetInsertBlock()->getParent();
+    auto env = createEntryBlockAlloca(currentFunction, "env", envType);
+    for (unsigned i = 0; i < values.size(); i++) {
+        builder->CreateStore(values[i], builder->CreateStructGEP(env, i));
+    }
+
+    llvm::Type *resultType;
+    auto chunk = createParallelChunk(ast, names, envType, resultType);
+    if (!chunk) {
+        return NULL;
+    }
+
+    auto result = createEntryBlockAlloca(currentFunction, "result", resultType);
+    auto int8PtrType = llvm::Type::getInt8PtrTy(*context);
+    auto int32Type = llvm::Type::getInt32Ty(*context);
+    std::vector<llvm::Value*> argValues;
+    argValues.push_back(chunk);
+    argValues.push_back(builder->CreateBitCast(env, int8PtrType));
+    argValues.push_back(fromValue);
+    argValues.push_back(toValue);
+    argValues.push_back(llvm::ConstantInt::get(int32Type, reduction));
+    argValues.push_back(llvm::ConstantInt::get(int32Type, resultType->isDoubleTy()));
+    argValues.push_back(builder->CreateBitCast(result, int8PtrType));
+    builder->CreateCall(parallelFor, argValues);
+
+    return builder->CreateLoad(result);
 }
 
-void CodeGenerator::visit(BlockAST *ast) {
-    visitChildren(ast);
+llvm::Value *CodeGenerator::visit(ForAST *ast) {
+    if (!ast->isRange()) {
+        return visitGeneratorLoop(ast);
+    }
+
+    auto fromValue = dispatch(ast->from());
+    auto toValue = dispatch(ast->to());
+    if (!fromValue || !toValue) {
+        return NULL;
+    }
+    if (!fromValue->getType()->isIntegerTy(64) || !toValue->getType()->isIntegerTy(64)) {
+        error("for range must be int");
+        return NULL;
+    }
+
+    // The bound lives in a local rather than a register so that the loop
+    // survives being suspended by a yield inside its body.
+    auto currentFunction = builder->GetInsertBlock()->getParent();
+    auto index = createLocal(currentFunction, ast->variableName(), getType("int"));
+    auto end = createLocal(currentFunction, ast->variableName() + ".end", getType("int"));
+    builder->CreateStore(fromValue, index);
+    builder->CreateStore(toValue, end);
+    (*namedValues)[ast->variableName()] = index;
+
+    auto condBlock = llvm::BasicBlock::Create(*context, "cond", currentFunction);
+    auto loopBlock = llvm::BasicBlock::Create(*context, "loop", currentFunction);
+    auto exitBlock = llvm::BasicBlock::Create(*context, "exit", currentFunction);
+    builder->CreateBr(condBlock);
+
+    builder->SetInsertPoint(condBlock);
+    builder->CreateCondBr(builder->CreateICmpSLT(builder->CreateLoad(index), builder->CreateLoad(end)), loopBlock, exitBlock);
+
+    builder->SetInsertPoint(loopBlock);
+    dispatch(ast->body());
+    builder->CreateStore(builder->CreateAdd(builder->CreateLoad(index), llvm::ConstantInt::get(getType("int"), 1)), index);
+    builder->CreateBr(condBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    return llvm::ConstantInt::get(getType("int"), 0);
 }
 
-void CodeGenerator::visit(VariableAST *ast) {
-    lastValue = builder->CreateLoad((*namedValues)[ast->getName()]);
+llvm::Value *CodeGenerator::visit(YieldAST *ast) {
+    if (!currentGenerator) {
+        error("yield outside of a generator");
+        return NULL;
+    }
+
+    auto value = dispatch(ast->value());
+    if (!value) {
+        return NULL;
+    }
+    if (!currentGenerator->valueType) {
+        currentGenerator->valueType = value->getType();
+    }
+    if (value->getType()->isIntegerTy(64) && currentGenerator->valueType->isDoubleTy()) {
+        value = builder->CreateSIToFP(value, getType("double"));
+    } else if (value->getType() != currentGenerator->valueType) {
+        error("yielded values must have the same type");
+        return NULL;
+    }
+
+    auto int64Type = getType("int");
+    auto valueSlot = createFrameSlot(*builder, currentGenerator->frame, 8, currentGenerator->valueType);
+    auto stateSlot = createFrameSlot(*builder, currentGenerator->frame, 0, int64Type);
+    auto resumeBlock = llvm::BasicBlock::Create(*context, "resume", builder->GetInsertBlock()->getParent());
+    auto state = currentGenerator->dispatch->getNumCases();
+    currentGenerator->dispatch->addCase(llvm::ConstantInt::get(*context, llvm::APInt(64, state)), resumeBlock);
+
+    builder->CreateStore(value, valueSlot);
+    builder->CreateStore(llvm::ConstantInt::get(int64Type, state), stateSlot);
+    createReturn(llvm::ConstantInt::getTrue(*context));
+
+    // Values computed before the suspension are gone on resume, so the
+    // yield evaluates to its operand reloaded from the frame.
+    builder->SetInsertPoint(resumeBlock);
+    return builder->CreateLoad(createFrameSlot(*builder, currentGenerator->frame, 8, currentGenerator->valueType));
+}
+
+llvm::Value *CodeGenerator::visit(TopAST *ast) {
+    for (AST* child : *ast->getChildren()) {
+        executeStatement(child);
+    }
+    finish();
+    return NULL;
+}
+
+llvm::Value *CodeGenerator::visit(BlockAST *ast) {
+    return visitChildren(ast);
+}
+
+llvm::Value *CodeGenerator::visit(VariableAST *ast) {
+    auto namedValue = namedValues->find(ast->getName());
+    if (namedValue == namedValues->end() || !namedValue->second) {
+        error(("unknown variable " + ast->getName()).c_str());
+        return NULL;
+    }
+    return builder->CreateLoad(namedValue->second);
 }
 
 void CodeGenerator::error(const char *str) {
+    errorCount++;
     std::cerr << "Error: " << str << std::endl;
 }
 
-void CodeGenerator::visitChildren(AST* ast) {
+llvm::Value *CodeGenerator::declareFunction(DefAST *ast) {
+    auto returnType = getType(ast->getTypeName());
+    if (!returnType) {
+        error("declarations need a return type");
+        return NULL;
+    }
+    auto function = module->getFunction(ast->name());
+    if (!function) {
+        auto functionType = llvm::FunctionType::get(returnType, *createArgTypes(ast->arguments()), false);
+        function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, ast->name(), module);
+        undefinedFunctions->insert(ast->name());
+    }
+    return function;
+}
+
+void CodeGenerator::runPendingStatements() {
+    for (AST* statement : *pendingStatements) {
+        auto wrapper = new DefAST("", statement, "");
+        wrapper->setLine(statement->getLine());
+        auto value = dispatch(wrapper);
+        if (!value) {
+            continue;
+        }
+        auto function = llvm::cast<llvm::Function>(value);
+        function->dump();
+        std::cout << "Evaluated to ";
+        if (function->getReturnType()->isIntegerTy()) {
+            int (*fp)() = (int (*)())(intptr_t)executionEngine->getPointerToFunction(function);
+            std::cout << fp();
+        } else if (function->getReturnType()->isDoubleTy()) {
+            double (*fp)() = (double (*)())(intptr_t)executionEngine->getPointerToFunction(function);
+            std::cout <<  fp();
+        }
+        std::cout <<  std::endl;
+    }
+    pendingStatements->clear();
+}
+
+void CodeGenerator::declareRuntime() {
+    auto int8PtrType = llvm::Type::getInt8PtrTy(*context);
+    auto int32Type = llvm::Type::getInt32Ty(*context);
+
+    std::vector<llvm::Type*> chunkArgTypes = { int8PtrType, getType("int"), getType("int"), int8PtrType };
+    chunkType = llvm::FunctionType::get(getType("void"), chunkArgTypes, false);
+
+    std::vector<llvm::Type*> parallelForArgTypes = {
+        chunkType->getPointerTo(), int8PtrType, getType("int"), getType("int"), int32Type, int32Type, int8PtrType
+    };
+    auto parallelForType = llvm::FunctionType::get(getType("void"), parallelForArgTypes, false);
+    parallelFor = llvm::Function::Create(parallelForType, llvm::Function::ExternalLinkage, "stone_parallel_for", module);
+    executionEngine->addGlobalMapping(parallelFor, (void*)&stone_parallel_for);
+
+    auto profileEnterType = llvm::FunctionType::get(getType("int"), int32Type, false);
+    std::vector<llvm::Type*> profileExitArgTypes = { int32Type, getType("int") };
+    auto profileExitType = llvm::FunctionType::get(getType("void"), profileExitArgTypes, false);
+    profileEnter = llvm::Function::Create(profileEnterType, llvm::Function::ExternalLinkage, "stone_profile_enter", module);
+    profileExit = llvm::Function::Create(profileExitType, llvm::Function::ExternalLinkage, "stone_profile_exit", module);
+    executionEngine->addGlobalMapping(profileEnter, (void*)&stone_profile_enter);
+    executionEngine->addGlobalMapping(profileExit, (void*)&stone_profile_exit);
+}
+
+llvm::Value *CodeGenerator::visitChildren(AST* ast) {
+    llvm::Value *value = NULL;
     for (AST* child : *ast->getChildren()) {
-        child->accept(this);
+        value = dispatch(child);
     }
+    return value;
 }
 
-llvm::AllocaInst *CodeGenerator::createEntryBlockAlloca(llvm::Function *function, VariableAST *variable) {
+llvm::AllocaInst *CodeGenerator::createEntryBlockAlloca(llvm::Function *function, const std::string &name, llvm::Type *type) {
+    llvm::IRBuilder<> tmpBuilder(&function->getEntryBlock(), function->getEntryBlock().begin());
+    return tmpBuilder.CreateAlloca(type, 0, name);
+}
+
+llvm::Value *CodeGenerator::createLocal(llvm::Function *function, VariableAST *variable) {
+    return createLocal(function, variable->getName(), getType(variable->getTypeName()));
+}
+
+llvm::Value *CodeGenerator::createLocal(llvm::Function *function, const std::string &name, llvm::Type *type) {
+    if (!currentGenerator || currentGenerator->resume != function) {
+        return createEntryBlockAlloca(function, name, type);
+    }
+    // Locals of a generator must outlive each suspension, so they are
+    // given an 8-byte aligned slot in the frame instead of an alloca.
+    auto offset = currentGenerator->frameSize;
+    auto size = executionEngine->getDataLayout()->getTypeAllocSize(type);
+    currentGenerator->frameSize += (size + 7) / 8 * 8;
     llvm::IRBuilder<> tmpBuilder(&function->getEntryBlock(), function->getEntryBlock().begin());
-    return tmpBuilder.CreateAlloca(getType(variable->getTypeName()), 0, variable->getName());
+    return createFrameSlot(tmpBuilder, currentGenerator->frame, offset, type);
+}
+
+llvm::Value *CodeGenerator::createFrameSlot(llvm::IRBuilder<> &slotBuilder, llvm::Value *frame, unsigned offset, llvm::Type *type) {
+    return slotBuilder.CreateBitCast(slotBuilder.CreateConstGEP1_32(frame, offset), type->getPointerTo());
+}
+
+// Frame layout: i64 state at 0, yielded value at 8, then arguments and
+// locals in declaration order from 16.
+llvm::Value *CodeGenerator::visitGenerator(DefAST *ast) {
+    if (currentGenerator) {
+        error("generators cannot be nested");
+        return NULL;
+    }
+    if (undefinedFunctions->count(ast->name())) {
+        error(("generator " + ast->name() + " cannot be forward declared").c_str());
+        return NULL;
+    }
+
+    auto last = &module->getFunctionList().back();
+    auto undefined = *undefinedFunctions;
+    int errors = errorCount;
+    namedValues->clear();
+    auto generator = new Generator;
+    generator->valueType = getType(ast->getTypeName());
+    generator->frameSize = 16;
+    generator->argTypes = *createArgTypes(ast->arguments());
+
+    auto int8PtrType = llvm::Type::getInt8PtrTy(*context);
+    auto functionType = llvm::FunctionType::get(llvm::Type::getInt1Ty(*context), int8PtrType, false);
+    auto function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, ast->name(), module);
+    generator->resume = function;
+    generator->frame = function->arg_begin();
+    generator->frame->setName("frame");
+
+    auto entryBlock = llvm::BasicBlock::Create(*context, "entry", function);
+    auto startBlock = llvm::BasicBlock::Create(*context, "start", function);
+    auto doneBlock = llvm::BasicBlock::Create(*context, "done", function);
+
+    builder->SetInsertPoint(entryBlock);
+    beginFunction(function, ast->getLine());
+    auto stateSlot = createFrameSlot(*builder, generator->frame, 0, getType("int"));
+    generator->dispatch = builder->CreateSwitch(builder->CreateLoad(stateSlot), doneBlock);
+    generator->dispatch->addCase(llvm::ConstantInt::get(*context, llvm::APInt(64, 0)), startBlock);
+
+    currentGenerator = generator;
+    for (int i = 0; i < ast->arguments()->size(); i++) {
+        auto arg = ast->arguments()->get(i);
+        (*namedValues)[arg->getName()] = createLocal(function, arg);
+    }
+
+    builder->SetInsertPoint(startBlock);
+    dispatch(ast->body());
+    builder->CreateStore(llvm::ConstantInt::get(getType("int"), -1), createFrameSlot(*builder, generator->frame, 0, getType("int")));
+    builder->CreateBr(doneBlock);
+
+    builder->SetInsertPoint(doneBlock);
+    createReturn(llvm::ConstantInt::getFalse(*context));
+    currentGenerator = NULL;
+
+    if (!generator->valueType) {
+        error("generator never yields a value");
+    }
+    if (errorCount > errors) {
+        delete generator;
+        discardFunctionsAfter(last, undefined);
+        return NULL;
+    }
+    functionPassManager->run(*function);
+    (*generators)[ast->name()] = generator;
+
+    return function;
+}
+
+llvm::Value *CodeGenerator::visitGeneratorLoop(ForAST *ast) {
+    auto call = dynamic_cast<CallFunctionAST*>(ast->iterable());
+    auto found = call ? generators->find(call->name()) : generators->end();
+    if (found == generators->end()) {
+        error("for expects a range or a generator call");
+        return NULL;
+    }
+    auto generator = found->second;
+    if (call->arguments()->size() != (int)generator->argTypes.size()) {
+        error("wrong number of generator arguments");
+        return NULL;
+    }
+
+    auto currentFunction = builder->GetInsertBlock()->getParent();
+    auto int8PtrType = llvm::Type::getInt8PtrTy(*context);
+    auto frameType = llvm::ArrayType::get(llvm::Type::getInt8Ty(*context), generator->frameSize);
+    auto frame = createLocal(currentFunction, ast->variableName() + ".frame", frameType);
+    if (auto frameAlloca = llvm::dyn_cast<llvm::AllocaInst>(frame)) {
+        frameAlloca->setAlignment(8);
+    }
+
+    builder->CreateStore(llvm::ConstantInt::get(getType("int"), 0), createFrameSlot(*builder, builder->CreateBitCast(frame, int8PtrType), 0, getType("int")));
+    for (unsigned i = 0; i < generator->argTypes.size(); i++) {
+        auto argValue = dispatch(call->arguments()->AST::get(i));
+        if (!argValue) {
+            return NULL;
+        }
+        if (argValue->getType()->isIntegerTy(64) && generator->argTypes[i]->isDoubleTy()) {
+            argValue = builder->CreateSIToFP(argValue, getType("double"));
+        }
+        builder->CreateStore(argValue, createFrameSlot(*builder, builder->CreateBitCast(frame, int8PtrType), 16 + 8 * i, generator->argTypes[i]));
+    }
+
+    auto variable = createLocal(currentFunction, ast->variableName(), generator->valueType);
+    (*namedValues)[ast->variableName()] = variable;
+
+    auto condBlock = llvm::BasicBlock::Create(*context, "cond", currentFunction);
+    auto loopBlock = llvm::BasicBlock::Create(*context, "loop", currentFunction);
+    auto exitBlock = llvm::BasicBlock::Create(*context, "exit", currentFunction);
+    builder->CreateBr(condBlock);
+
+    builder->SetInsertPoint(condBlock);
+    auto hasValue = builder->CreateCall(generator->resume, builder->CreateBitCast(frame, int8PtrType));
+    builder->CreateCondBr(hasValue, loopBlock, exitBlock);
+    // Only this call site is inlined, so the resume function is cloned
+    // once per loop rather than the whole module being revisited.
+    llvm::InlineFunctionInfo inlineInfo;
+    llvm::InlineFunction(hasValue, inlineInfo);
+
+    builder->SetInsertPoint(loopBlock);
+    auto valueSlot = createFrameSlot(*builder, builder->CreateBitCast(frame, int8PtrType), 8, generator->valueType);
+    builder->CreateStore(builder->CreateLoad(valueSlot), variable);
+    dispatch(ast->body());
+    builder->CreateBr(condBlock);
+
+    builder->SetInsertPoint(exitBlock);
+    return llvm::ConstantInt::get(getType("int"), 0);
+}
+
+llvm::Function *CodeGenerator::createParallelChunk(ParallelForAST *ast, const std::vector<std::string> &names, llvm::StructType *envType, llvm::Type *&resultType) {
+    auto savedBlock = builder->GetInsertBlock();
+    auto savedValues = namedValues;
+    auto savedGenerator = currentGenerator;
+    auto savedScope = debugScope;
+    auto savedProfileId = profileId;
+    auto savedProfileToken = profileToken;
+    namedValues = new std::map<std::string, llvm::Value*>;
+    currentGenerator = NULL;
+
+    auto chunk = llvm::Function::Create(chunkType, llvm::Function::InternalLinkage, "parallel.body", module);
+    auto argIterator = chunk->arg_begin();
+    llvm::Value *envArg = argIterator++;
+    llvm::Value *beginArg = argIterator++;
+    llvm::Value *endArg = argIterator++;
+    llvm::Value *resultArg = argIterator;
+    envArg->setName("env");
+    beginArg->setName("begin");
+    endArg->setName("end");
+    resultArg->setName("result");
+
+    auto entryBlock = llvm::BasicBlock::Create(*context, "entry", chunk);
+    auto condBlock = llvm::BasicBlock::Create(*context, "cond", chunk);
+    auto loopBlock = llvm::BasicBlock::Create(*context, "loop", chunk);
+    auto exitBlock = llvm::BasicBlock::Create(*context, "exit", chunk);
+
+    builder->SetInsertPoint(entryBlock);
+    beginFunction(chunk, ast->getLine());
+    auto env = builder->CreateBitCast(envArg, envType->getPointerTo());
+    for (unsigned i = 0; i < names.size(); i++) {
+        auto alloca = createEntryBlockAlloca(chunk, names[i], envType->getElementType(i));
+        builder->CreateStore(builder->CreateLoad(builder->CreateStructGEP(env, i)), alloca);
+        (*namedValues)[names[i]] = alloca;
+    }
+    auto index = createEntryBlockAlloca(chunk, ast->variableName(), getType("int"));
+    builder->CreateStore(beginArg, index);
+    (*namedValues)[ast->variableName()] = index;
+    builder->CreateBr(condBlock);
+
+    builder->SetInsertPoint(condBlock);
+    builder->CreateCondBr(builder->CreateICmpSLT(builder->CreateLoad(index), endArg), loopBlock, exitBlock);
+
+    // Each chunk is non-empty, so its first iteration seeds the accumulator
+    // and no identity element is needed for the reduction.
+    builder->SetInsertPoint(loopBlock);
+    auto current = builder->CreateLoad(index);
+    auto value = dispatch(ast->body());
+    resultType = value ? value->getType() : NULL;
+    if (value && (resultType->isIntegerTy(64) || resultType->isDoubleTy())) {
+        auto accumulator = createEntryBlockAlloca(chunk, "acc", resultType);
+        auto combined = createReduction(ast->reduction(), builder->CreateLoad(accumulator), value);
+        auto isFirst = builder->CreateICmpEQ(current, beginArg);
+        builder->CreateStore(builder->CreateSelect(isFirst, value, combined), accumulator);
+        builder->CreateStore(builder->CreateAdd(current, llvm::ConstantInt::get(getType("int"), 1)), index);
+        builder->CreateBr(condBlock);
+
+        builder->SetInsertPoint(exitBlock);
+        builder->CreateStore(builder->CreateLoad(accumulator), builder->CreateBitCast(resultArg, resultType->getPointerTo()));
+        createReturn();
+
+        functionPassManager->run(*chunk);
+    } else {
+        if (value) {
+            error("parallel for body must be int or double");
+        }
+        chunk->eraseFromParent();
+        chunk = NULL;
+    }
+
+    delete namedValues;
+    namedValues = savedValues;
+    currentGenerator = savedGenerator;
+    debugScope = savedScope;
+    profileId = savedProfileId;
+    profileToken = savedProfileToken;
+    builder->SetInsertPoint(savedBlock);
+    builder->SetCurrentDebugLocation(llvm::DebugLoc::get(ast->getLine(), 0, debugScope));
+    return chunk;
+}
+
+llvm::Value *CodeGenerator::createReduction(const std::string &reduction, llvm::Value *lValue, llvm::Value *rValue) {
+    bool isDouble = lValue->getType()->isDoubleTy();
+    if (reduction == "+") {
+        return isDouble ? builder->CreateFAdd(lValue, rValue) : builder->CreateAdd(lValue, rValue);
+    } else if (reduction == "min") {
+        auto isLess = isDouble ? builder->CreateFCmpOLT(lValue, rValue) : builder->CreateICmpSLT(lValue, rValue);
+        return builder->CreateSelect(isLess, lValue, rValue);
+    } else {
+        auto isGreater = isDouble ? builder->CreateFCmpOGT(lValue, rValue) : builder->CreateICmpSGT(lValue, rValue);
+        return builder->CreateSelect(isGreater, lValue, rValue);
+    }
+}
+
+int CodeGenerator::getReduction(const std::string &reduction) {
+    if (reduction == "+") {
+        return STONE_REDUCE_ADD;
+    } else if (reduction == "min") {
+        return STONE_REDUCE_MIN;
+    } else if (reduction == "max") {
+        return STONE_REDUCE_MAX;
+    } else {
+        return -1;
+    }
+}
+
+void CodeGenerator::beginFunction(llvm::Function *function, int line) {
+    if (inferring) {
+        debugScope = NULL;
+        return;
+    }
+    auto type = debugBuilder->createSubroutineType(debugFile, debugBuilder->getOrCreateArray(llvm::ArrayRef<llvm::Value*>()));
+    debugScope = debugBuilder->createFunction(debugFile, function->getName(), function->getName(), debugFile, line, type, false, true, line, 0, false, function);
+    builder->SetCurrentDebugLocation(llvm::DebugLoc::get(line, 0, debugScope));
+
+    if (profiling) {
+        profileId = Profiler::getInstance()->registerFunction(function->getName().str());
+        profileToken = builder->CreateCall(profileEnter, llvm::ConstantInt::get(llvm::Type::getInt32Ty(*context), profileId), "profile.token");
+    }
+}
+
+void CodeGenerator::createReturn(llvm::Value *value) {
+    createProfileExit();
+    builder->CreateRet(value);
+}
+
+void CodeGenerator::createReturn() {
+    createProfileExit();
+    builder->CreateRetVoid();
+}
+
+void CodeGenerator::createProfileExit() {
+    if (profiling && !inferring) {
+        std::vector<llvm::Value*> argValues = { llvm::ConstantInt::get(llvm::Type::getInt32Ty(*context), profileId), profileToken };
+        builder->CreateCall(profileExit, argValues);
+    }
 }
 
 void CodeGenerator::setFunctionArguments(llvm::Function *function, ArgumentsAST *arguments) {
@@ -217,39 +912,97 @@ void CodeGenerator::setFunctionArguments(llvm::Function *function, ArgumentsAST
     i = 0;
     for (auto argIterator = function->arg_begin(); i != function->arg_size(); ++argIterator, ++i) {
         auto arg = arguments->get(i);
-        auto alloca = createEntryBlockAlloca(function, arg);
-        builder->CreateStore(argIterator, alloca);
-        (*namedValues)[arg->getName()] = alloca;
+        auto local = createLocal(function, arg);
+        builder->CreateStore(argIterator, local);
+        (*namedValues)[arg->getName()] = local;
     }
 }
 
 llvm::Type *CodeGenerator::getType(const std::string &type) {
     if (type == "int") {
-        return llvm::Type::getInt64Ty(llvm::getGlobalContext());
+        return llvm::Type::getInt64Ty(*context);
     } else if (type == "double") {
-        return llvm::Type::getDoubleTy(llvm::getGlobalContext());
+        return llvm::Type::getDoubleTy(*context);
     } else if (type == "void") {
-        return llvm::Type::getVoidTy(llvm::getGlobalContext());
+        return llvm::Type::getVoidTy(*context);
+    } else {
+        return NULL;
+    }
+}
+
+llvm::Type *CodeGenerator::getType(char code) {
+    if (code == 'i') {
+        return getType("int");
+    } else if (code == 'd') {
+        return getType("double");
+    } else if (code == 'b') {
+        return llvm::Type::getInt1Ty(*context);
     } else {
         return NULL;
     }
 }
 
+// Infers the type by generating the body into a scratch function. This is
+// not a Traversal on purpose: the type of a call, a generator loop or a
+// mixed int/double expression follows from the module's signatures and the
+// exact coercions codegen applies, and a separate analysis that disagreed
+// would emit invalid IR. Anything that adds to the module on the way, such
+// as outlined parallel chunks and nested defs, is thrown away again so the
+// real pass starts from scratch.
 llvm::Type *CodeGenerator::getType(DefAST *ast) {
+    auto last = &module->getFunctionList().back();
+    auto undefined = *undefinedFunctions;
+    int errors = errorCount;
+    inferring = true;
+    debugScope = NULL;
+
     namedValues->clear();
     auto argTypes = createArgTypes(ast->arguments());
 
     auto *functionType = llvm::FunctionType::get(getType("void"), *argTypes, false);
     auto function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, ast->name(), module);
 
-    auto *block = llvm::BasicBlock::Create(llvm::getGlobalContext(), "entry", function);
+    auto *block = llvm::BasicBlock::Create(*context, "entry", function);
     builder->SetInsertPoint(block);
 
     setFunctionArguments(function, ast->arguments());
 
-    ast->body()->accept(this);
-    function->eraseFromParent();
-    return lastValue->getType();
+    auto body = dispatch(ast->body());
+    auto type = body && errorCount == errors ? body->getType() : NULL;
+
+    inferring = false;
+    discardFunctionsAfter(last, undefined);
+    if (!body && errorCount == errors) {
+        error(("body of " + (ast->name().empty() ? "top-level statement" : ast->name()) + " has no value").c_str());
+    }
+    return type;
+}
+
+// Erases every function added to the module after `last`, along with any
+// generator built for it, and turns declarations filled in since
+// `undefined` was taken back into declarations.
+void CodeGenerator::discardFunctionsAfter(llvm::Function *last, const std::set<std::string> &undefined) {
+    std::vector<llvm::Function*> created;
+    for (auto iterator = ++llvm::Module::iterator(last); iterator != module->end(); ++iterator) {
+        created.push_back(iterator);
+    }
+    for (auto createdFunction : created) {
+        createdFunction->dropAllReferences();
+    }
+    for (auto createdFunction : created) {
+        auto generator = generators->find(createdFunction->getName().str());
+        if (generator != generators->end() && generator->second->resume == createdFunction) {
+            delete generator->second;
+            generators->erase(generator);
+        }
+        createdFunction->eraseFromParent();
+    }
+    for (auto &name : undefined) {
+        if (!undefinedFunctions->count(name)) {
+            module->getFunction(name)->deleteBody();
+            undefinedFunctions->insert(name);
+        }
+    }
 }
 
 std::vector<llvm::Type*> *CodeGenerator::createArgTypes(ArgumentsAST *args) {
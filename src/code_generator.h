@@ -1,37 +1,102 @@
 #pragma once
+#include <set>
 #include "llvm.h"
 #include "ast.h"
-#include "ast_visitor.h"
+#include "ast_traversal.h"
+#include "ast_analysis.h"
+#include "runtime.h"
 
-class CodeGenerator : ASTVisitor {
+// A generator def is compiled into a resume function `i1 (i8* frame)`
+// which runs until the next yield and returns false once exhausted. The
+// frame holds the resume state, the last yielded value and every local,
+// and is owned by the consumer, usually as a stack allocation.
+struct Generator {
+    llvm::Function *resume;
+    llvm::Value *frame;
+    llvm::SwitchInst *dispatch;
+    llvm::Type *valueType;
+    std::vector<llvm::Type*> argTypes;
+    unsigned frameSize;
+};
+
+// Built on StaticVisitor for its typed results and the dispatch() hook that
+// attaches debug locations, not for speed: dispatch is noise next to IR
+// construction, and bench-traversal shows it no faster than ASTVisitor.
+class CodeGenerator : public StaticVisitor<CodeGenerator, llvm::Value*> {
 public:
     CodeGenerator();
+    CodeGenerator(const std::string&);
     ~CodeGenerator();
 
     void execute(TopAST*);
-    void visit(ASTLeaf*);
-    void visit(BinaryExprAST*);
-    void visit(ArgumentsAST*);
-    void visit(CallFunctionAST*);
-    void visit(IfAST*);
-    void visit(DefAST*);
-    void visit(TopAST*);
-    void visit(BlockAST*);
-    void visit(VariableAST*);
+    void executeStatement(AST*);
+    void finish();
+    void compile(TopAST*);
+    void *getPointerToFunction(const std::string&, const std::string&);
+    void enableProfiling();
+    bool hasErrors() const;
+    llvm::Value *dispatch(AST*);
+    llvm::Value *visit(ASTLeaf*);
+    llvm::Value *visit(BinaryExprAST*);
+    llvm::Value *visit(ArgumentsAST*);
+    llvm::Value *visit(CallFunctionAST*);
+    llvm::Value *visit(IfAST*);
+    llvm::Value *visit(DefAST*);
+    llvm::Value *visit(ParallelForAST*);
+    llvm::Value *visit(ForAST*);
+    llvm::Value *visit(YieldAST*);
+    llvm::Value *visit(TopAST*);
+    llvm::Value *visit(BlockAST*);
+    llvm::Value *visit(VariableAST*);
     void error(const char *);
 
 private:
+    llvm::LLVMContext *context;
     llvm::Module *module;
     llvm::IRBuilder<> *builder;
-    llvm::Value *lastValue;
-    std::map<std::string, llvm::AllocaInst*> *namedValues;
+    std::map<std::string, llvm::Value*> *namedValues;
     llvm::ExecutionEngine *executionEngine;
     llvm::FunctionPassManager *functionPassManager;
+    llvm::FunctionType *chunkType;
+    llvm::Function *parallelFor;
+    std::map<std::string, Generator*> *generators;
+    Generator *currentGenerator;
+    std::set<std::string> *undefinedFunctions;
+    std::vector<AST*> *pendingStatements;
+    llvm::DIBuilder *debugBuilder;
+    llvm::DIFile debugFile;
+    llvm::MDNode *debugScope;
+    int errorCount;
+    bool profiling;
+    bool inferring;
+    ConstantFolder *constants;
+    int32_t profileId;
+    llvm::Value *profileToken;
+    llvm::Function *profileEnter;
+    llvm::Function *profileExit;
 
-    void visitChildren(AST*);
-    llvm::AllocaInst *createEntryBlockAlloca(llvm::Function*, VariableAST*);
+    llvm::Value *declareFunction(DefAST*);
+    void runPendingStatements();
+    void declareRuntime();
+    llvm::Value *visitChildren(AST*);
+    llvm::AllocaInst *createEntryBlockAlloca(llvm::Function*, const std::string&, llvm::Type*);
+    llvm::Value *createLocal(llvm::Function*, VariableAST*);
+    llvm::Value *createLocal(llvm::Function*, const std::string&, llvm::Type*);
+    llvm::Value *createFrameSlot(llvm::IRBuilder<>&, llvm::Value*, unsigned, llvm::Type*);
+    llvm::Value *visitFunction(DefAST*);
+    llvm::Value *visitGenerator(DefAST*);
+    llvm::Value *visitGeneratorLoop(ForAST*);
+    llvm::Function *createParallelChunk(ParallelForAST*, const std::vector<std::string>&, llvm::StructType*, llvm::Type*&);
+    llvm::Value *createReduction(const std::string&, llvm::Value*, llvm::Value*);
+    int getReduction(const std::string&);
+    void beginFunction(llvm::Function*, int);
+    void createReturn(llvm::Value*);
+    void createReturn();
+    void createProfileExit();
+    void discardFunctionsAfter(llvm::Function*, const std::set<std::string>&);
     void setFunctionArguments(llvm::Function *, ArgumentsAST*);
     llvm::Type *getType(const std::string&);
+    llvm::Type *getType(char);
     llvm::Type *getType(DefAST*);
     std::vector<llvm::Type*> *createArgTypes(ArgumentsAST*);
 };
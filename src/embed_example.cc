@@ -0,0 +1,58 @@
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include "stone.h"
+
+// Compiles two scripts on two threads at once and calls typed entry points
+// into each, checking every result against the same computation in C++.
+
+static std::atomic<bool> failed(false);
+
+static void runSquares() {
+    StoneScript script("def square(x:int):int { x * x + 1 }", "squares");
+    auto square = script.getFunction<int64_t(int64_t)>("square");
+    if (!square) {
+        std::cerr << "squares: square(int):int not found" << std::endl;
+        failed = true;
+        return;
+    }
+    int64_t total = 0;
+    for (int64_t i = 0; i < 1000000; i++) {
+        if (square(i) != i * i + 1) {
+            std::cerr << "squares: wrong result for " << i << std::endl;
+            failed = true;
+            return;
+        }
+        total += square(i);
+    }
+    std::cout << "squares: " << total << std::endl;
+}
+
+static void runAverages() {
+    StoneScript script("def mean(a:double, b:double):double { (a + b) / 2.0 }", "averages");
+    auto mean = script.getFunction<double(double, double)>("mean");
+    if (!mean || script.getFunction<int64_t(int64_t)>("mean")) {
+        std::cerr << "averages: mean(double, double):double not found or mistyped" << std::endl;
+        failed = true;
+        return;
+    }
+    double total = 0;
+    for (int i = 0; i < 1000000; i++) {
+        if (mean(i, 1.0) != (i + 1.0) / 2.0) {
+            std::cerr << "averages: wrong result for " << i << std::endl;
+            failed = true;
+            return;
+        }
+        total += mean(i, 1.0);
+    }
+    std::cout << "averages: " << total << std::endl;
+}
+
+int main() {
+    std::thread squares(runSquares);
+    std::thread averages(runAverages);
+    squares.join();
+    averages.join();
+    return failed ? 1 : 0;
+}
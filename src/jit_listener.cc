@@ -0,0 +1,182 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "jit_listener.h"
+
+// Record layouts follow tools/perf/util/jitdump.h in the Linux tree.
+static const uint32_t jitDumpMagic = 0x4A695444;
+static const uint32_t jitDumpVersion = 1;
+static const uint32_t jitCodeLoad = 0;
+static const uint32_t jitCodeDebugInfo = 2;
+
+// The dump describes code for the machine the JIT targets, which is the
+// one stone itself was built for.
+#if defined(__x86_64__)
+static const uint32_t elfMachine = EM_X86_64;
+#elif defined(__i386__)
+static const uint32_t elfMachine = EM_386;
+#elif defined(__aarch64__)
+static const uint32_t elfMachine = EM_AARCH64;
+#elif defined(__arm__)
+static const uint32_t elfMachine = EM_ARM;
+#else
+static const uint32_t elfMachine = EM_NONE;
+#endif
+
+struct JITDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t totalSize;
+    uint32_t elfMachine;
+    uint32_t pad;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct JITDumpRecordHeader {
+    uint32_t id;
+    uint32_t totalSize;
+    uint64_t timestamp;
+};
+
+struct JITDumpCodeLoad {
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t codeAddress;
+    uint64_t codeSize;
+    uint64_t codeIndex;
+};
+
+struct JITDumpDebugEntry {
+    uint64_t address;
+    int32_t line;
+    int32_t discriminator;
+};
+
+static uint64_t timestamp() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+template <typename T>
+static void append(std::string &buffer, const T &value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+JITListener::JITListener() : perfMap(NULL), jitDump(-1), codeIndex(0), failed(false) {
+    if (std::getenv("STONE_PERF_MAP")) {
+        perfMap = fopen(("/tmp/perf-" + std::to_string(getpid()) + ".map").c_str(), "a");
+        if (!perfMap) {
+            reportFailure("cannot open the perf map");
+        }
+    }
+    if (std::getenv("STONE_JITDUMP")) {
+        if (elfMachine == EM_NONE) {
+            reportFailure("STONE_JITDUMP is not supported on this target");
+        } else {
+            auto path = "/tmp/jit-" + std::to_string(getpid()) + ".dump";
+            jitDump = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+            if (jitDump < 0) {
+                reportFailure("cannot open the jitdump file");
+            }
+        }
+    }
+    if (jitDump >= 0) {
+        // perf only picks up the dump if the process maps it executable.
+        if (mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, jitDump, 0) == MAP_FAILED) {
+            reportFailure("cannot map the jitdump file, perf will ignore it");
+        }
+        JITDumpHeader header = { jitDumpMagic, jitDumpVersion, sizeof(JITDumpHeader), elfMachine, 0, (uint32_t)getpid(), timestamp(), 0 };
+        writeAll(&header, sizeof(header));
+    }
+}
+
+JITListener *JITListener::getInstance() {
+    static JITListener *instance = new JITListener;
+    return instance;
+}
+
+bool JITListener::isEnabled() const {
+    return perfMap || jitDump >= 0;
+}
+
+void JITListener::NotifyFunctionEmitted(const llvm::Function &function, void *code, size_t size, const EmittedFunctionDetails &details) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string name = function.getName().str();
+    if (perfMap) {
+        writePerfMap(name, code, size);
+    }
+    if (jitDump >= 0) {
+        writeJITDump(name, code, size, details);
+    }
+}
+
+void JITListener::writePerfMap(const std::string &name, void *code, size_t size) {
+    fprintf(perfMap, "%lx %lx %s\n", (unsigned long)code, (unsigned long)size, name.c_str());
+    fflush(perfMap);
+}
+
+void JITListener::writeJITDump(const std::string &name, void *code, size_t size, const EmittedFunctionDetails &details) {
+    auto &context = details.MF->getFunction()->getContext();
+    if (!details.LineStarts.empty()) {
+        std::string debugInfo;
+        append(debugInfo, (uint64_t)(uintptr_t)code);
+        append(debugInfo, (uint64_t)details.LineStarts.size());
+        for (auto &lineStart : details.LineStarts) {
+            JITDumpDebugEntry entry = { lineStart.Address, (int32_t)lineStart.Loc.getLine(), 0 };
+            append(debugInfo, entry);
+            llvm::DIScope scope(lineStart.Loc.getScope(context));
+            debugInfo += scope.getFilename().str();
+            debugInfo += '\0';
+        }
+        writeRecord(jitCodeDebugInfo, debugInfo);
+    }
+
+    JITDumpCodeLoad load = { (uint32_t)getpid(), (uint32_t)syscall(SYS_gettid), (uint64_t)(uintptr_t)code, (uint64_t)(uintptr_t)code, size, codeIndex++ };
+    std::string codeLoad;
+    append(codeLoad, load);
+    codeLoad += name;
+    codeLoad += '\0';
+    codeLoad.append(static_cast<const char*>(code), size);
+    writeRecord(jitCodeLoad, codeLoad);
+}
+
+void JITListener::writeRecord(uint32_t id, const std::string &body) {
+    JITDumpRecordHeader header = { id, (uint32_t)(sizeof(JITDumpRecordHeader) + body.size()), timestamp() };
+    writeAll(&header, sizeof(header));
+    writeAll(body.data(), body.size());
+}
+
+void JITListener::writeAll(const void *data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        auto written = write(jitDump, bytes, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            reportFailure("cannot write the jitdump file, it is incomplete");
+            return;
+        }
+        bytes += written;
+        size -= written;
+    }
+}
+
+// Reported once; a profiler that keeps failing should not flood stderr.
+void JITListener::reportFailure(const char *message) {
+    if (!failed) {
+        failed = true;
+        std::cerr << "Error: " << message << std::endl;
+    }
+}
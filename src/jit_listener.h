@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "llvm.h"
+
+// Publishes JIT'd functions to external profilers. STONE_PERF_MAP=1 appends
+// symbols to /tmp/perf-<pid>.map, and STONE_JITDUMP=1 writes code and line
+// tables to /tmp/jit-<pid>.dump for `perf inject --jit` (x86, x86-64, ARM
+// and AArch64 only). The first failure to open or write either file is
+// reported on stderr. A single instance is shared by every CodeGenerator
+// in the process.
+class JITListener : public llvm::JITEventListener {
+public:
+    static JITListener *getInstance();
+    bool isEnabled() const;
+    void NotifyFunctionEmitted(const llvm::Function&, void*, size_t, const EmittedFunctionDetails&);
+
+private:
+    JITListener();
+    void writePerfMap(const std::string&, void*, size_t);
+    void writeJITDump(const std::string&, void*, size_t, const EmittedFunctionDetails&);
+    void writeRecord(uint32_t, const std::string&);
+    void writeAll(const void*, size_t);
+    void reportFailure(const char*);
+
+    std::mutex mutex;
+    FILE *perfMap;
+    int jitDump;
+    uint64_t codeIndex;
+    bool failed;
+};
@@ -6,9 +6,17 @@
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JIT.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/CodeGen/MachineFunction.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/DIBuilder.h>
+#include <llvm/DebugInfo.h>
+#include <llvm/Support/Dwarf.h>
 #include <llvm/PassManager.h>
 #include <llvm/Analysis/Verifier.h>
 #include <llvm/Analysis/Passes.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/Threading.h>
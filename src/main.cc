@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <iostream>
+#include <string>
+#include <thread>
 #include "ast.h"
 #include "parse.hh"
 #include "code_generator.h"
+#include "profiler.h"
+#include "bounded_queue.h"
 
 extern "C" {
     int yyparse();
@@ -11,16 +15,66 @@ extern "C" {
 extern FILE * yyin;
 
 extern TopAST *ast;
+extern void (*statementHandler)(AST*);
+
+// Statements travel from the parser to the code generator through this
+// queue, so the first statements compile and run while the rest of the
+// file is still being parsed.
+static BoundedQueue<AST*> statements(64);
+
+static void pushStatement(AST *statement) {
+    statements.push(statement);
+}
 
 int main(int argc, char *argv[]) {
-    if ( argc > 1 ) {
-        yyin = fopen(argv[1], "r");
+    bool profiling = false;
+    bool serial = false;
+    bool parseOnly = false;
+    const char *fileName = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--profile") {
+            profiling = true;
+        } else if (std::string(argv[i]) == "--serial") {
+            serial = true;
+        } else if (std::string(argv[i]) == "--parse-only") {
+            parseOnly = true;
+        } else {
+            fileName = argv[i];
+        }
+    }
+
+    if ( fileName ) {
+        yyin = fopen(fileName, "r");
     } else {
         yyin = stdin;
 	}
-    yyparse();
-    std::cout << *ast << std::endl;
-    CodeGenerator generator;
-    generator.execute(ast);
+    if (parseOnly) {
+        return yyparse();
+    }
+    CodeGenerator generator(fileName ? fileName : "<stdin>");
+    if (profiling) {
+        generator.enableProfiling();
+    }
+    if (serial) {
+        yyparse();
+        std::cout << *ast << std::endl;
+        generator.execute(ast);
+    } else {
+        std::thread codeGeneration([&generator] {
+            AST *statement;
+            while (statements.pop(statement)) {
+                std::cout << *statement << std::endl;
+                generator.executeStatement(statement);
+            }
+            generator.finish();
+        });
+        statementHandler = pushStatement;
+        yyparse();
+        statements.close();
+        codeGeneration.join();
+    }
+    if (profiling) {
+        Profiler::getInstance()->report(std::cerr);
+    }
     return 0;
 }
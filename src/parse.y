@@ -5,8 +5,10 @@
 #include <iostream>
 #include "ast.h"
 
+extern int yylineno;
+
 void yyerror(const char *msg) {
-    fprintf(stderr, "parser error near %s\n", msg);
+    fprintf(stderr, "line %d: parser error near %s\n", yylineno, msg);
 }
 
 extern "C" {
@@ -16,8 +18,27 @@ extern int yylex();
 
 TopAST *ast;
 
+// When set, each top-level statement is handed over as soon as it has been
+// parsed instead of being collected into `ast`.
+void (*statementHandler)(AST*) = NULL;
+
+static AST *locate(AST *ast, int line) {
+    ast->setLine(line);
+    return ast;
+}
+
+static AST *emit(AST *statement) {
+    if (statement && statementHandler) {
+        statementHandler(statement);
+        return NULL;
+    }
+    return statement;
+}
+
 %}
 
+%locations
+
 %union {
 	int integer_type;
     double double_type;
@@ -27,10 +48,11 @@ TopAST *ast;
 
 %token<integer_type> tINTEGER
 %token<double_type> tDOUBLE
-%token tLBRACE tRBRACE tLPAREN tRPAREN tADD tMINUS tMUL tDIV tGT tLT tSET tEQL tCOMMA tSEMICOLON tCOLON tEOL tIF tELSE tDEF
+%token tLBRACE tRBRACE tLPAREN tRPAREN tADD tMINUS tMUL tDIV tGT tLT tSET tEQL tCOMMA tSEMICOLON tCOLON tDOTDOT tEOL tIF tELSE tDEF tPARALLEL tFOR tIN tREDUCE tYIELD
 %token<str> tIDENTIFIER
+%type<str> reduction
 
-%type<ast> program statements statement block expression primary arguments
+%type<ast> program topStatements topStatement statements statement block expression primary arguments
 
 %left tGT tLT
 %left tADD tMINUS
@@ -39,7 +61,14 @@ TopAST *ast;
 %%
 
 program:
-      statements { ast = (TopAST*)$$; }
+      topStatements { ast = (TopAST*)$$; }
+
+topStatements:
+      topStatement { $$ = new BlockAST($1); }
+    | topStatements tEOL topStatement { $$->add($3); }
+
+topStatement:
+      statement { $$ = emit($1); }
 
 statements:
       statement { $$ = new BlockAST($1); }
@@ -47,9 +76,13 @@ statements:
 
 statement:
       { $$ = NULL; }
-    | tDEF tIDENTIFIER tLPAREN arguments tRPAREN tCOLON tIDENTIFIER block { $$ = new DefAST(*$2, $4, $8, *$7); }
-    | tIF expression block { $$ = new IfAST($2, $3); }
-    | tIF expression block tELSE block { $$ = new IfAST($2, $3, $5); }
+    | tDEF tIDENTIFIER tLPAREN arguments tRPAREN tCOLON tIDENTIFIER block { $$ = locate(new DefAST(*$2, $4, $8, *$7), @1.first_line); }
+    | tDEF tIDENTIFIER tLPAREN arguments tRPAREN tCOLON tIDENTIFIER { $$ = locate(new DefAST(*$2, $4, NULL, *$7), @1.first_line); }
+    | tIF expression block { $$ = locate(new IfAST($2, $3), @1.first_line); }
+    | tIF expression block tELSE block { $$ = locate(new IfAST($2, $3, $5), @1.first_line); }
+    | tFOR tIDENTIFIER tIN expression tDOTDOT expression block { $$ = locate(new ForAST(*$2, $4, $6, $7), @1.first_line); }
+    | tFOR tIDENTIFIER tIN expression block { $$ = locate(new ForAST(*$2, $4, $5), @1.first_line); }
+    | tYIELD expression { $$ = locate(new YieldAST($2), @1.first_line); }
     | expression { $$ = $1; }
 
 block:
@@ -57,22 +90,27 @@ block:
 
 expression:
       primary { $$ = $1; }
-    | primary tSET expression { $$ = new BinaryExprAST("=", $1, $3); }
-    | tMINUS expression { $$ = new BinaryExprAST("-", $2); }
-    | expression tGT expression { $$ = new BinaryExprAST(">", $1, $3); }
-    | expression tLT expression { $$ = new BinaryExprAST("<", $1, $3); }
-    | expression tADD expression { $$ = new BinaryExprAST("+", $1, $3); }
-    | expression tMINUS expression { $$ = new BinaryExprAST("-", $1, $3); }
-    | expression tMUL expression { $$ = new BinaryExprAST("*", $1, $3); }
-    | expression tDIV expression { $$ = new BinaryExprAST("/", $1, $3); }
+    | primary tSET expression { $$ = locate(new BinaryExprAST("=", $1, $3), @2.first_line); }
+    | tMINUS expression { $$ = locate(new BinaryExprAST("-", $2), @1.first_line); }
+    | expression tGT expression { $$ = locate(new BinaryExprAST(">", $1, $3), @2.first_line); }
+    | expression tLT expression { $$ = locate(new BinaryExprAST("<", $1, $3), @2.first_line); }
+    | expression tADD expression { $$ = locate(new BinaryExprAST("+", $1, $3), @2.first_line); }
+    | expression tMINUS expression { $$ = locate(new BinaryExprAST("-", $1, $3), @2.first_line); }
+    | expression tMUL expression { $$ = locate(new BinaryExprAST("*", $1, $3), @2.first_line); }
+    | expression tDIV expression { $$ = locate(new BinaryExprAST("/", $1, $3), @2.first_line); }
     | tLPAREN expression tRPAREN { $$ = $2; }
+    | tPARALLEL tFOR tIDENTIFIER tIN expression tDOTDOT expression tREDUCE reduction block { $$ = locate(new ParallelForAST(*$3, $5, $7, *$9, $10), @1.first_line); }
+
+reduction:
+      tADD { $$ = new std::string("+"); }
+    | tIDENTIFIER { $$ = $1; }
 
 primary:
-      tINTEGER { $$ = new ASTLeaf(new IntegerToken($1)); }
-    | tDOUBLE { $$ = new ASTLeaf(new DoubleToken($1)); }
-    | tIDENTIFIER { $$ = new VariableAST(*$1); }
-    | tIDENTIFIER tCOLON tIDENTIFIER { $$ = new VariableAST(*$1, *$3); }
-    | tIDENTIFIER tLPAREN arguments tRPAREN { $$ = new CallFunctionAST(*$1, $3); }
+      tINTEGER { $$ = locate(new ASTLeaf(new IntegerToken($1)), @1.first_line); }
+    | tDOUBLE { $$ = locate(new ASTLeaf(new DoubleToken($1)), @1.first_line); }
+    | tIDENTIFIER { $$ = locate(new VariableAST(*$1), @1.first_line); }
+    | tIDENTIFIER tCOLON tIDENTIFIER { $$ = locate(new VariableAST(*$1, *$3), @1.first_line); }
+    | tIDENTIFIER tLPAREN arguments tRPAREN { $$ = locate(new CallFunctionAST(*$1, $3), @1.first_line); }
 
 arguments:
       { $$ = new ArgumentsAST(); }
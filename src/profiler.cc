@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <new>
+#include "profiler.h"
+#include "runtime.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+static inline uint64_t readCycles() {
+    return __rdtsc();
+}
+#else
+#include <chrono>
+
+static inline uint64_t readCycles() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+#endif
+
+Profiler *Profiler::getInstance() {
+    static Profiler *instance = new Profiler;
+    return instance;
+}
+
+int32_t Profiler::registerFunction(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    names.push_back(name);
+    return names.size() - 1;
+}
+
+thread_local Profiler::ThreadProfile *Profiler::currentProfile = NULL;
+
+Profiler::Counter *Profiler::allocateCounters(size_t size) {
+    void *memory = NULL;
+    if (posix_memalign(&memory, alignof(Counter), std::max<size_t>(size, 1) * sizeof(Counter)) != 0) {
+        throw std::bad_alloc();
+    }
+    std::memset(memory, 0, size * sizeof(Counter));
+    return static_cast<Counter*>(memory);
+}
+
+// Slow path of enter: creates the calling thread's profile or makes room
+// for functions registered since its counters were last grown.
+Profiler::ThreadProfile *Profiler::growThreadProfile(int32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto profile = currentProfile;
+    if (!profile) {
+        profile = new ThreadProfile;
+        profile->counters = NULL;
+        profile->size = 0;
+        profile->attributed = 0;
+        threads.push_back(profile);
+        currentProfile = profile;
+    }
+    auto size = std::max<size_t>(names.size(), id + 1);
+    auto counters = allocateCounters(size);
+    if (profile->counters) {
+        std::memcpy(counters, profile->counters, profile->size * sizeof(Counter));
+        std::free(profile->counters);
+    }
+    profile->counters = counters;
+    profile->size = size;
+    return profile;
+}
+
+// `attributed` is the thread's total exclusive time so far. The token is
+// the time not yet attributed when the call starts; at exit, everything
+// unattributed since then belongs to this call, because callees have
+// already added their own exclusive time.
+uint64_t Profiler::enter(int32_t id) {
+    auto profile = currentProfile;
+    if (!profile || profile->size <= (size_t)id) {
+        profile = growThreadProfile(id);
+    }
+    auto now = readCycles();
+    auto &counter = profile->counters[id];
+    counter.calls++;
+    if (counter.depth++ == 0) {
+        counter.outermostStart = now;
+    }
+    return now - profile->attributed;
+}
+
+// Inclusive time is only counted by the outermost activation, so
+// recursion is not counted twice.
+void Profiler::exit(int32_t id, uint64_t token) {
+    auto profile = currentProfile;
+    auto now = readCycles();
+    auto &counter = profile->counters[id];
+    auto exclusive = now - profile->attributed - token;
+    counter.exclusive += exclusive;
+    profile->attributed += exclusive;
+    if (--counter.depth == 0) {
+        counter.inclusive += now - counter.outermostStart;
+    }
+}
+
+void Profiler::report(std::ostream &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto totals = allocateCounters(names.size());
+    uint64_t totalExclusive = 0;
+    for (auto profile : threads) {
+        for (size_t id = 0; id < profile->size; id++) {
+            totals[id].calls += profile->counters[id].calls;
+            totals[id].inclusive += profile->counters[id].inclusive;
+            totals[id].exclusive += profile->counters[id].exclusive;
+            totalExclusive += profile->counters[id].exclusive;
+        }
+    }
+
+    std::vector<size_t> order;
+    for (size_t id = 0; id < names.size(); id++) {
+        if (totals[id].calls) {
+            order.push_back(id);
+        }
+    }
+    std::sort(order.begin(), order.end(), [totals](size_t lhs, size_t rhs) {
+        return totals[lhs].exclusive > totals[rhs].exclusive;
+    });
+
+    out << std::left << std::setw(24) << "function" << std::right
+        << std::setw(14) << "calls" << std::setw(18) << "inclusive" << std::setw(18) << "exclusive" << std::setw(8) << "%" << std::endl;
+    for (auto id : order) {
+        out << std::left << std::setw(24) << names[id] << std::right
+            << std::setw(14) << totals[id].calls
+            << std::setw(18) << totals[id].inclusive
+            << std::setw(18) << totals[id].exclusive
+            << std::setw(7) << std::fixed << std::setprecision(1) << 100.0 * totals[id].exclusive / std::max<uint64_t>(totalExclusive, 1) << "%"
+            << std::endl;
+    }
+    std::free(totals);
+}
+
+// Looked up once at load time so the hooks skip the getInstance guard.
+static Profiler *profiler = Profiler::getInstance();
+
+extern "C" uint64_t stone_profile_enter(int32_t id) {
+    return profiler->enter(id);
+}
+
+extern "C" void stone_profile_exit(int32_t id, uint64_t token) {
+    profiler->exit(id, token);
+}
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "runtime.h"
+#include "thread_pool.h"
+
+// The number of chunks depends only on the size of the range, never on the
+// number of threads, so reductions are merged identically on any machine.
+static const int64_t maxChunks = 256;
+
+template <typename T>
+static T reduce(int32_t reduction, T lhs, T rhs) {
+    switch (reduction) {
+    case STONE_REDUCE_MIN:
+        return std::min(lhs, rhs);
+    case STONE_REDUCE_MAX:
+        return std::max(lhs, rhs);
+    default:
+        return lhs + rhs;
+    }
+}
+
+template <typename T>
+static void merge(int32_t reduction, std::vector<int64_t> &slots, void *result) {
+    T value;
+    std::memcpy(&value, &slots[0], sizeof(T));
+    for (size_t i = 1; i < slots.size(); i++) {
+        T chunkValue;
+        std::memcpy(&chunkValue, &slots[i], sizeof(T));
+        value = reduce(reduction, value, chunkValue);
+    }
+    std::memcpy(result, &value, sizeof(T));
+}
+
+extern "C" void stone_parallel_for(StoneChunkFunction chunk, void *env, int64_t from, int64_t to,
+                                   int32_t reduction, int32_t isDouble, void *result) {
+    if (from >= to) {
+        if (reduction != STONE_REDUCE_ADD) {
+            std::cerr << "Error: min/max reduction over an empty range" << std::endl;
+        }
+        std::memset(result, 0, sizeof(int64_t));
+        return;
+    }
+
+    int64_t size = to - from;
+    int64_t chunkCount = std::min(size, maxChunks);
+    int64_t chunkSize = (size + chunkCount - 1) / chunkCount;
+    chunkCount = (size + chunkSize - 1) / chunkSize;
+
+    std::vector<int64_t> slots(chunkCount);
+    std::vector<ThreadPool::Task> tasks;
+    for (int64_t i = 0; i < chunkCount; i++) {
+        int64_t begin = from + i * chunkSize;
+        int64_t end = std::min(begin + chunkSize, to);
+        void *slot = &slots[i];
+        tasks.push_back([chunk, env, begin, end, slot] {
+            chunk(env, begin, end, slot);
+        });
+    }
+    ThreadPool::getInstance()->run(tasks);
+
+    if (isDouble) {
+        merge<double>(reduction, slots, result);
+    } else {
+        merge<int64_t>(reduction, slots, result);
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+
+enum StoneReduction {
+    STONE_REDUCE_ADD = 0,
+    STONE_REDUCE_MIN = 1,
+    STONE_REDUCE_MAX = 2,
+};
+
+// Generated code calls into these; they are bound into the JIT by address,
+// so the signatures must stay in sync with CodeGenerator::declareRuntime.
+extern "C" {
+    typedef void (*StoneChunkFunction)(void *env, int64_t begin, int64_t end, void *result);
+
+    // An empty range reduces to 0. That is the sum of nothing, but min and
+    // max have no such value, so for them it is also reported as an error.
+    void stone_parallel_for(StoneChunkFunction, void *env, int64_t from, int64_t to,
+                            int32_t reduction, int32_t isDouble, void *result);
+
+    uint64_t stone_profile_enter(int32_t id);
+    void stone_profile_exit(int32_t id, uint64_t token);
+}
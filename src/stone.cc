@@ -0,0 +1,50 @@
+#include <mutex>
+#include "stone.h"
+#include "ast.h"
+#include "code_generator.h"
+
+extern "C" {
+    int yyparse();
+}
+typedef struct yy_buffer_state *YY_BUFFER_STATE;
+YY_BUFFER_STATE yy_scan_string(const char*);
+void yy_delete_buffer(YY_BUFFER_STATE);
+extern int yylineno;
+
+extern TopAST *ast;
+
+// The generated parser and scanner keep their state in globals.
+static std::mutex parserMutex;
+
+static TopAST *parse(const std::string &source) {
+    std::lock_guard<std::mutex> lock(parserMutex);
+    yylineno = 1;
+    auto buffer = yy_scan_string(source.c_str());
+    int status = yyparse();
+    yy_delete_buffer(buffer);
+    return status == 0 ? ast : NULL;
+}
+
+StoneScript::StoneScript(const std::string &source) : StoneScript(source, "<string>") {
+}
+
+StoneScript::StoneScript(const std::string &source, const std::string &fileName) {
+    generator = new CodeGenerator(fileName);
+    auto topAst = parse(source);
+    if (topAst) {
+        generator->compile(topAst);
+    }
+    valid = topAst && !generator->hasErrors();
+}
+
+StoneScript::~StoneScript() {
+    delete generator;
+}
+
+bool StoneScript::isValid() const {
+    return valid;
+}
+
+void *StoneScript::getPointerToFunction(const std::string &name, const std::string &signature) {
+    return valid ? generator->getPointerToFunction(name, signature) : NULL;
+}
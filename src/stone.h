@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+class CodeGenerator;
+
+// Embedding API. A StoneScript compiles the defs of a source once; typed
+// native entry points are then looked up by name and called directly:
+//
+//     StoneScript script(source);
+//     auto score = script.getFunction<double(double, int64_t)>("score");
+//     double total = score(0.5, 42);
+//
+// Stone's int is int64_t. Only defs are compiled; any other top-level
+// statement makes the script invalid rather than being run. Separate
+// scripts share no mutable state and may be compiled and called from
+// different threads.
+//
+// The JIT'd code is owned by the script: pointers returned by getFunction
+// dangle once the StoneScript is destroyed.
+
+template <typename T>
+struct StoneType;
+
+template <>
+struct StoneType<int64_t> {
+    static constexpr char code = 'i';
+};
+
+template <>
+struct StoneType<double> {
+    static constexpr char code = 'd';
+};
+
+template <>
+struct StoneType<bool> {
+    static constexpr char code = 'b';
+};
+
+template <typename Signature>
+struct StoneSignature;
+
+template <typename R, typename... Args>
+struct StoneSignature<R(Args...)> {
+    static std::string codes() {
+        return std::string({ StoneType<R>::code, StoneType<Args>::code... });
+    }
+};
+
+class StoneScript {
+public:
+    StoneScript(const std::string&);
+    StoneScript(const std::string&, const std::string&);
+    ~StoneScript();
+    StoneScript(const StoneScript&) = delete;
+    StoneScript& operator=(const StoneScript&) = delete;
+
+    bool isValid() const;
+    void *getPointerToFunction(const std::string&, const std::string&);
+
+    // Returns NULL if there is no def with this name and signature.
+    template <typename Signature>
+    Signature *getFunction(const std::string &name) {
+        return (Signature*)(intptr_t)getPointerToFunction(name, StoneSignature<Signature>::codes());
+    }
+
+private:
+    CodeGenerator *generator;
+    bool valid;
+};
@@ -0,0 +1,124 @@
+#include <cstdlib>
+#include "thread_pool.h"
+
+static thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool(int size) : queued(0), stopping(false) {
+    for (int i = 0; i < size - 1; i++) {
+        workers.push_back(new Worker);
+    }
+    for (int i = 0; i < size - 1; i++) {
+        threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (auto worker : workers) {
+        delete worker;
+    }
+}
+
+ThreadPool *ThreadPool::getInstance() {
+    static ThreadPool *instance = [] {
+        int size = std::thread::hardware_concurrency();
+        if (const char *env = std::getenv("STONE_NUM_THREADS")) {
+            size = std::atoi(env);
+        }
+        return new ThreadPool(size > 0 ? size : 1);
+    }();
+    return instance;
+}
+
+int ThreadPool::size() const {
+    return workers.size() + 1;
+}
+
+void ThreadPool::run(std::vector<Task> &tasks) {
+    if (workers.empty()) {
+        for (auto &task : tasks) {
+            task();
+        }
+        return;
+    }
+
+    std::atomic<int> remaining(tasks.size());
+    for (size_t i = 0; i < tasks.size(); i++) {
+        auto task = tasks[i];
+        auto worker = workers[i % workers.size()];
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->tasks.push_back([task, &remaining] {
+            task();
+            remaining--;
+        });
+    }
+    queued += tasks.size();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_all();
+
+    // The calling thread helps out instead of blocking, which also keeps
+    // nested parallel loops from deadlocking inside a worker.
+    Task task;
+    while (remaining > 0) {
+        if (pop(currentWorker, task) || steal(currentWorker, task)) {
+            task();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::workerLoop(int index) {
+    currentWorker = index;
+    Task task;
+    while (true) {
+        if (pop(index, task) || steal(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::pop(int index, Task &task) {
+    if (index < 0) {
+        return false;
+    }
+    auto worker = workers[index];
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (worker->tasks.empty()) {
+        return false;
+    }
+    task = worker->tasks.back();
+    worker->tasks.pop_back();
+    queued--;
+    return true;
+}
+
+bool ThreadPool::steal(int index, Task &task) {
+    int size = workers.size();
+    for (int i = 1; i <= size; i++) {
+        auto victim = workers[((index < 0 ? 0 : index) + i) % size];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
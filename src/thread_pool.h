@@ -0,0 +1,36 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    ThreadPool(int);
+    ~ThreadPool();
+    static ThreadPool *getInstance();
+    int size() const;
+    void run(std::vector<Task>&);
+
+private:
+    struct Worker {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+    };
+
+    std::vector<Worker*> workers;
+    std::vector<std::thread> threads;
+    std::atomic<int> queued;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    bool stopping;
+
+    void workerLoop(int);
+    bool pop(int, Task&);
+    bool steal(int, Task&);
+};